@@ -0,0 +1,45 @@
+/*
+ * Minimal Clight control socket client, eg: to be bound to backlight hotkeys.
+ * Build with: gcc -o control_client control_client.c -I/usr/include/clight
+ * Usage: control_client [state | inc PCT | dec PCT | capture | inhibit 0/1]
+ */
+#include <control.h>
+
+int main(int argc, char *argv[]) {
+    enum clight_ctl_ops op = CLIGHT_CTL_GET_STATE;
+    uint32_t flags = 0;
+    double arg = argc > 2 ? strtod(argv[2], NULL) : 0.0;
+    
+    if (argc > 1) {
+        if (!strcmp(argv[1], "inc")) {
+            op = CLIGHT_CTL_INC_BL;
+        } else if (!strcmp(argv[1], "dec")) {
+            op = CLIGHT_CTL_DEC_BL;
+        } else if (!strcmp(argv[1], "capture")) {
+            op = CLIGHT_CTL_CAPTURE;
+            flags = CLIGHT_CTL_RESET_TIMER;
+        } else if (!strcmp(argv[1], "inhibit")) {
+            op = CLIGHT_CTL_INHIBIT;
+        } else if (strcmp(argv[1], "state")) {
+            fprintf(stderr, "Usage: %s [state | inc PCT | dec PCT | capture | inhibit 0/1]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    
+    int fd = clight_ctl_open();
+    if (fd == -1) {
+        fprintf(stderr, "Clight control socket not available.\n");
+        return EXIT_FAILURE;
+    }
+    
+    clight_ctl_resp_t resp;
+    int r = clight_ctl_call(fd, op, flags, arg, &resp);
+    if (r == 0) {
+        printf("Backlight: %.0lf%%\tAmbient: %.2lf\tTemp: %dK\tInhibited: %d\n", 
+               resp.bl_pct * 100, resp.ambient_br, resp.temp, resp.inhibited);
+    } else {
+        fprintf(stderr, "Request failed: %s.\n", strerror(-r));
+    }
+    clight_ctl_close(fd);
+    return r == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,29 @@
+/*
+ * Minimal Clight state snapshot reader, eg: for status bars.
+ * Build with: gcc -o snapshot_reader snapshot_reader.c -I/usr/include/clight
+ * Run with -w to print backlight level each second without ever waking Clight up.
+ */
+#include <snapshot.h>
+
+int main(int argc, char *argv[]) {
+    const clight_snapshot_t *snap = clight_snapshot_open();
+    if (!snap) {
+        fprintf(stderr, "Clight snapshot not available.\n");
+        return EXIT_FAILURE;
+    }
+    
+    const int watch = argc > 1 && !strcmp(argv[1], "-w");
+    do {
+        clight_snapshot_t s;
+        if (clight_snapshot_read(snap, &s) != 0) {
+            fprintf(stderr, "Clight is not running.\n");
+            break;
+        }
+        printf("Backlight: %.0lf%%\tAmbient: %.2lf\tTemp: %dK\tScreen: %.2lf\n", 
+               s.bl_pct * 100, s.ambient_br, s.temp, s.screen_comp);
+        fflush(stdout);
+    } while (watch && sleep(1) == 0);
+    
+    clight_snapshot_close(snap);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,83 @@
+/*
+ * Measure Clight bus api p50/p99 latency while its main context is busy, eg: capturing.
+ * A child process keeps requesting captures (without changing backlight) while the parent
+ * times BlPct Properties.Get calls: run it against builds with and without INTERFACE
+ * on its own context and compare p99s.
+ * Build with: gcc -O2 -o api_latency api_latency.c $(pkg-config --cflags --libs libsystemd)
+ * Usage: api_latency [CALLS (5000)] [CAPTURE_INTERVAL_MS (100), 0 to disable load]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <systemd/sd-bus.h>
+
+#define CLIGHT_SERVICE  "org.clight.clight"
+#define CLIGHT_PATH     "/org/clight/clight"
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Keep main context busy: Capture(reset_timer = false, capture_only = true) is not waited for */
+static void capture_loop(const int interval_ms) {
+    sd_bus *bus = NULL;
+    if (sd_bus_open_user(&bus) < 0) {
+        _exit(EXIT_FAILURE);
+    }
+    const struct timespec interval = { interval_ms / 1000, (interval_ms % 1000) * 1000000L };
+    for (;;) {
+        sd_bus_call_method_async(bus, NULL, CLIGHT_SERVICE, CLIGHT_PATH, CLIGHT_SERVICE, "Capture", NULL, NULL, "bb", 0, 1);
+        sd_bus_flush(bus);
+        while (sd_bus_process(bus, NULL) > 0);
+        nanosleep(&interval, NULL);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const int n = argc > 1 ? atoi(argv[1]) : 5000;
+    const int interval_ms = argc > 2 ? atoi(argv[2]) : 100;
+    uint64_t *samples = calloc(n > 0 ? n : 1, sizeof(uint64_t));
+    sd_bus *bus = NULL;
+    if (n <= 0 || !samples || sd_bus_open_user(&bus) < 0) {
+        fprintf(stderr, "Usage: %s [CALLS] [CAPTURE_INTERVAL_MS]; a user bus is needed.\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    
+    pid_t loader = -1;
+    if (interval_ms > 0 && (loader = fork()) == 0) {
+        capture_loop(interval_ms);
+    }
+    
+    int failures = 0;
+    for (int i = 0; i < n; i++) {
+        double pct;
+        const uint64_t start = now_ns();
+        failures += sd_bus_get_property_trivial(bus, CLIGHT_SERVICE, CLIGHT_PATH, CLIGHT_SERVICE, "BlPct", NULL, 'd', &pct) < 0;
+        samples[i] = now_ns() - start;
+        /* Spread calls over captures */
+        usleep(1000);
+    }
+    
+    if (loader > 0) {
+        kill(loader, SIGTERM);
+        waitpid(loader, NULL, 0);
+    }
+    
+    qsort(samples, n, sizeof(uint64_t), cmp_u64);
+    printf("%d calls%s: p50 %.1f us\tp99 %.1f us\tmax %.1f us\t(%d failed)\n", n, interval_ms > 0 ? " under capture load" : "",
+           samples[n / 2] / 1e3, samples[n * 99 / 100] / 1e3, samples[n - 1] / 1e3, failures);
+    sd_bus_flush_close_unref(bus);
+    free(samples);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,94 @@
+/*
+ * Compare Clight control socket round-trip latency against bus api,
+ * both on a kept-open connection and on a new connection per call (eg: a hotkey spawning a client).
+ * Read-only requests are used (CLIGHT_CTL_GET_STATE and BlPct property), thus it is safe to run on a live session.
+ * Build with (from repo root): gcc -O2 -Isrc -o ctl_latency Extra/harness/ctl_latency.c $(pkg-config --cflags --libs libsystemd)
+ * Usage: ctl_latency [ITERATIONS (10000)]; control_socket must be enabled in clight conf.
+ */
+#include <time.h>
+#include <inttypes.h>
+#include <systemd/sd-bus.h>
+#include <control.h>
+
+#define CLIGHT_SERVICE  "org.clight.clight"
+#define CLIGHT_PATH     "/org/clight/clight"
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *what, uint64_t *samples, const int n, const int failures) {
+    qsort(samples, n, sizeof(uint64_t), cmp_u64);
+    printf("%-24s p50 %8.1f us\tp99 %8.1f us\tmax %8.1f us\t(%d failed)\n", what,
+           samples[n / 2] / 1e3, samples[n * 99 / 100] / 1e3, samples[n - 1] / 1e3, failures);
+}
+
+static int ctl_get(int fd) {
+    clight_ctl_resp_t resp;
+    return clight_ctl_call(fd, CLIGHT_CTL_GET_STATE, 0, 0.0, &resp);
+}
+
+static int bus_get(sd_bus *bus) {
+    double pct;
+    return sd_bus_get_property_trivial(bus, CLIGHT_SERVICE, CLIGHT_PATH, CLIGHT_SERVICE, "BlPct", NULL, 'd', &pct);
+}
+
+int main(int argc, char *argv[]) {
+    const int n = argc > 1 ? atoi(argv[1]) : 10000;
+    const int n_conn = n / 10 > 0 ? n / 10 : 1;
+    uint64_t *samples = calloc(n, sizeof(uint64_t));
+    sd_bus *bus = NULL;
+    int fd = clight_ctl_open();
+    if (n <= 0 || !samples || fd == -1 || sd_bus_open_user(&bus) < 0) {
+        fprintf(stderr, "Clight control socket or user bus not available.\n");
+        return EXIT_FAILURE;
+    }
+    
+    int failures = 0;
+    for (int i = 0; i < n; i++) {
+        const uint64_t start = now_ns();
+        failures += ctl_get(fd) != 0;
+        samples[i] = now_ns() - start;
+    }
+    report("socket", samples, n, failures);
+    
+    failures = 0;
+    for (int i = 0; i < n; i++) {
+        const uint64_t start = now_ns();
+        failures += bus_get(bus) < 0;
+        samples[i] = now_ns() - start;
+    }
+    report("bus", samples, n, failures);
+    
+    failures = 0;
+    for (int i = 0; i < n_conn; i++) {
+        const uint64_t start = now_ns();
+        int conn = clight_ctl_open();
+        failures += conn == -1 || ctl_get(conn) != 0;
+        clight_ctl_close(conn);
+        samples[i] = now_ns() - start;
+    }
+    report("socket, new connection", samples, n_conn, failures);
+    
+    failures = 0;
+    for (int i = 0; i < n_conn; i++) {
+        const uint64_t start = now_ns();
+        sd_bus *conn = NULL;
+        failures += sd_bus_open_user(&conn) < 0 || bus_get(conn) < 0;
+        sd_bus_flush_close_unref(conn);
+        samples[i] = now_ns() - start;
+    }
+    report("bus, new connection", samples, n_conn, failures);
+    
+    sd_bus_flush_close_unref(bus);
+    clight_ctl_close(fd);
+    free(samples);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,158 @@
+/*
+ * Count TIMERS wakeups over a simulated hour with lid closed, without waiting an hour.
+ * TIMERS module is built in with a fake CLOCK_BOOTTIME and a fake timerfd, that is "expired"
+ * by jumping the clock straight to its armed deadline; periodic modules (BACKLIGHT, SCREEN, GAMMA)
+ * are mimicked by timers that get rearmed on each TIMER_UPD with their default timeout.
+ * Build with: gcc -D_GNU_SOURCE -I../../src -I../../src/conf -I../../src/modules -I../../src/utils -I../../src/pubsub \
+ *              -o deepidle_wakeups deepidle_wakeups.c ../../src/pubsub/topics.c $(pkg-config --cflags --libs libmodule) -lm
+ * Usage: deepidle_wakeups [SECONDS (3600)] [MAX_WAKEUPS (0)]; exits 1 if more than MAX_WAKEUPS were counted with lid closed.
+ */
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include "commons.h"
+
+#define FAKE_TIMER_FD   1000
+
+typedef struct {
+    const char *name;
+    int period;                 // timeout (s) the owner module rearms its timer with on each expiration
+    bool essential;
+} sim_timer_t;
+
+static int fake_clock_gettime(clockid_t clk, struct timespec *ts);
+static int fake_timerfd_create(int clk, int flags);
+static int fake_timerfd_settime(int fd, int flags, const struct itimerspec *new_value, struct itimerspec *old_value);
+static ssize_t fake_read(int fd, void *buf, size_t count);
+static void fake_tell(const message_t *msg);
+
+/* Drive timers.c with the fake clock and timerfd below */
+#undef m_tell
+#define m_tell(recipient, msg, size, autofree)      fake_tell(msg)
+#define clock_gettime                               fake_clock_gettime
+#define timerfd_create                              fake_timerfd_create
+#define timerfd_settime                             fake_timerfd_settime
+#define read                                        fake_read
+#include "timers.c"
+#undef read
+#undef timerfd_settime
+#undef timerfd_create
+#undef clock_gettime
+
+static const sim_timer_t sim_timers[] = {
+    { "backlight", 10 * 60, false },    // bl_conf.timeout[ON_AC][DAY]
+    { "screen", 30, false },            // screen_conf.timeout[ON_AC]
+    { "gamma", 60, false },             // long_transition step
+    { "relay-sync", 0, true },          // only armed while syncing conf writes
+};
+
+state_t state = {0};
+conf_t conf = {0};
+static uint64_t fake_now = NSEC_PER_SEC;
+static uint64_t fake_armed;                 // fake timerfd absolute deadline; 0 if disarmed
+static int periods[MAX_TIMERS];
+static uint64_t deliveries;
+
+static int fake_clock_gettime(UNUSED clockid_t clk, struct timespec *ts) {
+    ts->tv_sec = fake_now / NSEC_PER_SEC;
+    ts->tv_nsec = fake_now % NSEC_PER_SEC;
+    return 0;
+}
+
+static int fake_timerfd_create(UNUSED int clk, UNUSED int flags) {
+    return FAKE_TIMER_FD;
+}
+
+static int fake_timerfd_settime(UNUSED int fd, UNUSED int flags, const struct itimerspec *new_value, UNUSED struct itimerspec *old_value) {
+    fake_armed = (uint64_t)new_value->it_value.tv_sec * NSEC_PER_SEC + new_value->it_value.tv_nsec;
+    return 0;
+}
+
+static ssize_t fake_read(UNUSED int fd, void *buf, size_t count) {
+    memset(buf, 0, count);
+    *(uint64_t *)buf = 1;
+    return count;
+}
+
+/* Owner module received TIMER_UPD: rearm its timer, as BACKLIGHT/SCREEN/GAMMA do */
+static void fake_tell(const message_t *msg) {
+    deliveries++;
+    timer_set(msg->timer.id, periods[msg->timer.id], 0);
+}
+
+/* Wakeups are counted by run() instead */
+void stats_wakeup(UNUSED const char *source) {
+    
+}
+
+void log_message(UNUSED const char *filename, UNUSED int lineno, const char type, const char *log_msg, ...) {
+    if (type == 'W' || type == 'E') {
+        va_list args;
+        va_start(args, log_msg);
+        vfprintf(stderr, log_msg, args);
+        va_end(args);
+    }
+}
+
+/* Run the fake clock forward by secs seconds, firing timerfd on each deadline; returns the number of wakeups */
+static uint64_t run(unsigned int secs) {
+    const uint64_t end = fake_now + (uint64_t)secs * NSEC_PER_SEC;
+    uint64_t wakeups = 0;
+    while (fake_armed != 0 && fake_armed <= end) {
+        /* A deadline already in the past fires straight away: never move the clock backwards */
+        if (fake_armed > fake_now) {
+            fake_now = fake_armed;
+        }
+        on_timerfd();
+        wakeups++;
+    }
+    fake_now = end;
+    return wakeups;
+}
+
+static void set_lid(enum lid_states lid) {
+    state.lid_state = lid;
+    state.deep_idle = lid == CLOSED;
+    update_held();
+}
+
+int main(int argc, char *argv[]) {
+    const unsigned int secs = argc > 1 ? strtoul(argv[1], NULL, 10) : 3600;
+    const long max_wakeups = argc > 2 ? strtol(argv[2], NULL, 10) : 0;
+
+    timer_fd = fake_timerfd_create(CLOCK_BOOTTIME, 0);
+    for (size_t i = 0; i < sizeof(sim_timers) / sizeof(*sim_timers); i++) {
+        const int id = timer_new(NULL, sim_timers[i].name, sim_timers[i].period, 0);
+        if (id == -1) {
+            return EXIT_FAILURE;
+        }
+        periods[id] = sim_timers[i].period;
+        timer_set_essential(id, sim_timers[i].essential);
+    }
+
+    set_lid(OPEN);
+    const uint64_t open_wakeups = run(secs);
+    printf("%-24s %8" PRIu64 " (%.2f/h)\n", "lid open", open_wakeups, open_wakeups * 3600.0 / (secs ? secs : 1));
+
+    set_lid(CLOSED);
+    deliveries = 0;
+    const uint64_t closed_wakeups = run(secs);
+    printf("%-24s %8" PRIu64 " (%.2f/h), %" PRIu64 " TIMER_UPD delivered\n", "lid closed", closed_wakeups,
+           closed_wakeups * 3600.0 / (secs ? secs : 1), deliveries);
+
+    /* Held timers expired meanwhile must fire straight away, all in a single wakeup, once lid is opened */
+    deliveries = 0;
+    set_lid(OPEN);
+    const uint64_t reopen_wakeups = run(0);
+    printf("%-24s %8" PRIu64 ", %" PRIu64 " TIMER_UPD delivered\n", "lid reopened", reopen_wakeups, deliveries);
+
+    if (max_wakeups >= 0 && closed_wakeups > (uint64_t)max_wakeups) {
+        printf("FAIL: more than %ld wakeups with lid closed.\n", max_wakeups);
+        return EXIT_FAILURE;
+    }
+    if (reopen_wakeups != 1) {
+        printf("FAIL: held timers did not fire in a single wakeup on lid opened.\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,107 @@
+/*
+ * Benchmark sunrise/sunset per-call formula against cached yearly ephemeris table lookups (src/utils/ephemeris.c).
+ * Table cache file is written to a temporary XDG_CACHE_HOME; lookups are checked against per-call results.
+ * Build with (from repo root):
+ *   gcc -O2 -D_GNU_SOURCE -Isrc -Isrc/conf -Isrc/modules -Isrc/utils -Isrc/pubsub -o ephemeris_bench \
+ *       Extra/harness/ephemeris_bench.c src/utils/ephemeris.c src/utils/my_math.c \
+ *       $(pkg-config --cflags --libs gsl libmodule) -lm
+ * Usage: ephemeris_bench [ITERATIONS (100000)]
+ */
+#include <stdarg.h>
+#include "ephemeris.h"
+#include "my_math.h"
+
+state_t state;
+conf_t conf;
+
+void log_message(UNUSED const char *filename, UNUSED int lineno, const char type, const char *log_msg, ...) {
+    if (type != 'D') {
+        va_list args;
+        va_start(args, log_msg);
+        vfprintf(stderr, log_msg, args);
+        va_end(args);
+    }
+}
+
+static double now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static void report(const char *what, const double start, const int n) {
+    printf("%-28s %10.1f ns/op\n", what, (now_ns() - start) / n);
+}
+
+int main(int argc, char *argv[]) {
+    const int n = argc > 1 ? atoi(argv[1]) : 100000;
+    /* Rounded to ephemeris table resolution, so that both paths compute exactly the same thing */
+    const float lat = 45.5f, lng = 9.2f;
+    
+    char cache_dir[] = "/tmp/ephemeris_bench.XXXXXX";
+    if (n <= 0 || !mkdtemp(cache_dir)) {
+        fprintf(stderr, "Usage: %s [ITERATIONS]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    setenv("XDG_CACHE_HOME", cache_dir, 1);
+    
+    volatile time_t sink = 0;
+    time_t tt = 0;
+    double start = now_ns();
+    for (int i = 0; i < n; i++) {
+        calculate_sunrise(lat, lng, &tt, i & 1);
+        sink += tt;
+        calculate_sunset(lat, lng, &tt, i & 1);
+        sink += tt;
+    }
+    report("per-call sunrise+sunset", start, n);
+    
+    /* First lookup builds and stores the table */
+    start = now_ns();
+    ephemeris_get(lat, lng, SUNRISE, false, &tt);
+    report("table build + store", start, 1);
+    
+    start = now_ns();
+    for (int i = 0; i < n; i++) {
+        ephemeris_get(lat, lng, SUNRISE, i & 1, &tt);
+        sink += tt;
+        ephemeris_get(lat, lng, SUNSET, i & 1, &tt);
+        sink += tt;
+    }
+    report("table sunrise+sunset", start, n);
+    
+    /* Key change: table is loaded back from cache file */
+    ephemeris_get(lat + 1, lng, SUNRISE, false, &tt);
+    start = now_ns();
+    ephemeris_get(lat, lng, SUNRISE, false, &tt);
+    report("table load from cache", start, 1);
+    
+    const int years = n / 1000 > 0 ? n / 1000 : 1;
+    static time_t events[367][SIZE_EVENTS];
+    start = now_ns();
+    for (int i = 0; i < years; i++) {
+        calculate_year_events(lat, lng, 2024, events, 367);
+        sink += events[i % 367][SUNRISE];
+    }
+    report("year events batch", start, years);
+    
+    int mismatches = 0;
+    for (int tomorrow = 0; tomorrow <= 1; tomorrow++) {
+        time_t expected, got;
+        if (calculate_sunrise(lat, lng, &expected, tomorrow) == 0 && 
+            (ephemeris_get(lat, lng, SUNRISE, tomorrow, &got) != 0 || got != expected)) {
+            mismatches++;
+        }
+        if (calculate_sunset(lat, lng, &expected, tomorrow) == 0 && 
+            (ephemeris_get(lat, lng, SUNSET, tomorrow, &got) != 0 || got != expected)) {
+            mismatches++;
+        }
+    }
+    printf("%d mismatches between table and per-call results.\n", mismatches);
+    
+    char cache_file[PATH_MAX + 1];
+    snprintf(cache_file, PATH_MAX, "%s/clight_ephemeris", cache_dir);
+    unlink(cache_file);
+    rmdir(cache_dir);
+    return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
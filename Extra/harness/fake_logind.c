@@ -0,0 +1,164 @@
+/*
+ * Fake logind stand-in to check Clight logind idle backend (src/utils/idler.c) without a real session.
+ * Bus helpers used by idler.c are replaced by a fake login1 Session, whose IdleHint is driven by this test:
+ * its PropertiesChanged signals are sent on the user bus by a second connection, like logind would do on system bus.
+ * Build with (from repo root):
+ *   gcc -D_GNU_SOURCE -Isrc -Isrc/conf -Isrc/modules -Isrc/utils -Isrc/pubsub -o fake_logind \
+ *       Extra/harness/fake_logind.c src/utils/idler.c $(pkg-config --cflags --libs libsystemd libmodule)
+ * Run it inside a user session: it exits with 77 (skipped) if no user bus is available, 1 on any failure.
+ */
+#include <stdarg.h>
+#include "idler.h"
+
+#define SESSION_PATH    "/org/freedesktop/login1/session/fake"
+#define CHECK(cond, what) \
+do { \
+    if (cond) { \
+        printf("ok: %s\n", what); \
+    } else { \
+        printf("FAIL: %s\n", what); \
+        failures++; \
+    } \
+} while (0)
+
+state_t state;
+conf_t conf;
+
+static sd_bus *client_bus;          // Clight side
+static sd_bus *logind_bus;          // fake logind side
+static int hint;                    // fake session IdleHint
+static uint64_t hint_since;         // fake session IdleSinceHintMonotonic (us)
+static int last_idle = -1;          // latest Idle signal received by client handler
+static uint64_t last_since;
+static int failures;
+
+/* Fake bus helpers, with same behaviour as bus.c ones against logind */
+
+int call(const bus_args *a, UNUSED const char *signature, ...) {
+    if (!strcmp(a->member, "GetSession")) {
+        strncpy(a->reply_userdata, SESSION_PATH, PATH_MAX);
+        return 0;
+    }
+    return -1;
+}
+
+int add_match(const bus_args *a, sd_bus_slot **slot, sd_bus_message_handler_t cb) {
+    char match[PATH_MAX + 128];
+    snprintf(match, sizeof(match), "type='signal',path='%s',interface='%s',member='%s'", a->path, a->interface, a->member);
+    return -(sd_bus_add_match(client_bus, slot, match, cb, NULL) < 0);
+}
+
+int set_property(UNUSED const bus_args *a, UNUSED const char type, UNUSED const void *value) {
+    return -1;
+}
+
+int get_property(const bus_args *a, UNUSED const char *type, void *userptr, UNUSED int size) {
+    if (!strcmp(a->member, "IdleHint")) {
+        *(int *)userptr = hint;
+    } else if (!strcmp(a->member, "IdleSinceHintMonotonic")) {
+        *(uint64_t *)userptr = hint_since;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+void stats_count(UNUSED const char *counter) {
+
+}
+
+void log_message(const char *filename, int lineno, const char type, const char *log_msg, ...) {
+    va_list args;
+    va_start(args, log_msg);
+    fprintf(stderr, "(%c){%s:%d}\t", type, filename, lineno);
+    vfprintf(stderr, log_msg, args);
+    va_end(args);
+}
+
+static uint64_t now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+/* Process client bus for up to ms milliseconds */
+static void pump(int ms) {
+    const uint64_t deadline = now_us() + ms * 1000ULL;
+    uint64_t now;
+    while ((now = now_us()) < deadline) {
+        while (sd_bus_process(client_bus, NULL) > 0);
+        sd_bus_wait(client_bus, deadline - now);
+    }
+}
+
+/* Change fake session IdleHint, emitting PropertiesChanged like logind does */
+static void set_hint(int idle) {
+    hint = idle;
+    hint_since = now_us();
+    sd_bus_emit_signal(logind_bus, SESSION_PATH, "org.freedesktop.DBus.Properties", "PropertiesChanged",
+                       "sa{sv}as", "org.freedesktop.login1.Session", 2,
+                       "IdleHint", "b", hint,
+                       "IdleSinceHintMonotonic", "t", hint_since,
+                       0);
+    sd_bus_flush(logind_bus);
+    pump(200);
+}
+
+/* Client handler, same signature as clightd Idle.Client Idle signal, as parsed by IDLE module */
+static int on_idle(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
+    int idle;
+    uint64_t since = 0;
+    if (sd_bus_message_read(m, "b", &idle) >= 0) {
+        sd_bus_message_read(m, "t", &since);
+        last_idle = idle;
+        last_since = since;
+    }
+    return 0;
+}
+
+int main(void) {
+    if (sd_bus_open_user(&client_bus) < 0 || sd_bus_open_user(&logind_bus) < 0) {
+        fprintf(stderr, "No user bus available.\n");
+        return 77;
+    }
+
+    conf.logind_idle = true;
+    char client[PATH_MAX + 1] = {0};
+    sd_bus_slot *slot = NULL;
+    CHECK(idle_init(client, &slot, 10, on_idle) == 0 && !strcmp(client, SESSION_PATH), "client is our session");
+    pump(100);
+    CHECK(last_idle == -1, "active session does not fire");
+
+    set_hint(true);
+    CHECK(last_idle == 1, "IdleHint fires client");
+    CHECK(last_since == hint_since, "idle since hint is forwarded");
+
+    set_hint(true);
+    last_idle = -1;
+    set_hint(true);
+    CHECK(last_idle == -1, "unchanged IdleHint does not fire again");
+
+    set_hint(false);
+    CHECK(last_idle == 0, "user activity fires client");
+
+    idle_client_stop(client);
+    set_hint(true);
+    set_hint(false);
+    set_hint(true);
+    CHECK(last_idle == 0, "stopped client does not fire");
+
+    const uint64_t start = now_us();
+    idle_client_start(client, 10);
+    CHECK(last_idle == 1, "restarted client fires if session is still idle");
+    CHECK(last_since >= start, "client restart counts as user activity");
+
+    idle_client_destroy(client);
+    set_hint(false);
+    CHECK(last_idle == 1, "destroyed client does not fire");
+
+    sd_bus_slot_unref(slot);
+    sd_bus_flush_close_unref(logind_bus);
+    sd_bus_flush_close_unref(client_bus);
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,173 @@
+/*
+ * Stress Clight org.freedesktop.ScreenSaver inhibition registry.
+ * CLIENTS processes, each with its own bus connection, keep HELD inhibitions and churn them through Inhibit/UnInhibit:
+ * calls/s and Inhibit/UnInhibit latencies are reported, and cookies held at the same time are checked to be unique.
+ * Build with: gcc -O2 -o inhibit_stress inhibit_stress.c $(pkg-config --cflags --libs libsystemd)
+ * Usage: inhibit_stress [CLIENTS (8)] [CALLS per client (5000)] [HELD per client (16)]
+ * Clight will be inhibited while it runs.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <systemd/sd-bus.h>
+
+#define SC_SERVICE      "org.freedesktop.ScreenSaver"
+#define SC_PATH         "/org/freedesktop/ScreenSaver"
+
+static int clients = 8, calls = 5000, held = 16;
+static uint64_t *samples;           // [clients][calls] latencies, shared with children
+static uint32_t *cookies;           // [clients][held] cookies held at the end of each run, shared with children
+static int ready_pipe[2], go_pipe[2];
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    const uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int inhibit(sd_bus *bus, uint32_t *cookie) {
+    sd_bus_message *reply = NULL;
+    int r = sd_bus_call_method(bus, SC_SERVICE, SC_PATH, SC_SERVICE, "Inhibit", NULL, &reply, "ss", "inhibit_stress", "stress test");
+    if (r >= 0) {
+        r = sd_bus_message_read(reply, "u", cookie);
+    }
+    sd_bus_message_unref(reply);
+    return r;
+}
+
+static int uninhibit(sd_bus *bus, uint32_t cookie) {
+    return sd_bus_call_method(bus, SC_SERVICE, SC_PATH, SC_SERVICE, "UnInhibit", NULL, NULL, "u", cookie);
+}
+
+/* Returns number of failed calls, or -1 if the bus is not available */
+static int run_client(const int id) {
+    char c = 0;
+    sd_bus *bus = NULL;
+    if (sd_bus_open_user(&bus) < 0) {
+        /* Do not leave parent waiting for us */
+        write(ready_pipe[1], &c, 1);
+        return -1;
+    }
+    
+    uint64_t *lat = samples + (size_t)id * calls;
+    uint32_t *mine = cookies + (size_t)id * held;
+    int failures = 0, num_held = 0, oldest = 0;
+    for (int i = 0; i < calls; i++) {
+        const uint64_t start = now_ns();
+        if (num_held < held) {
+            /* Fill held ring */
+            uint32_t c;
+            if (inhibit(bus, &c) >= 0) {
+                for (int j = 0; j < num_held; j++) {
+                    /* Cookie collision with our own held ones */
+                    failures += mine[(oldest + j) % held] == c;
+                }
+                mine[(oldest + num_held++) % held] = c;
+            } else {
+                failures++;
+            }
+        } else {
+            failures += uninhibit(bus, mine[oldest]) < 0;
+            oldest = (oldest + 1) % held;
+            num_held--;
+        }
+        lat[i] = now_ns() - start;
+    }
+    
+    /* Publish held cookies and wait for parent to check them */
+    for (int j = num_held; j < held; j++) {
+        mine[(oldest + j) % held] = 0;
+    }
+    write(ready_pipe[1], &c, 1);
+    read(go_pipe[0], &c, 1);
+    for (int j = 0; j < num_held; j++) {
+        failures += uninhibit(bus, mine[(oldest + j) % held]) < 0;
+    }
+    sd_bus_flush_close_unref(bus);
+    return failures;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        clients = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        calls = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        held = atoi(argv[3]);
+    }
+    if (clients <= 0 || calls <= 0 || held <= 0 || clients > 255) {
+        fprintf(stderr, "Usage: %s [CLIENTS] [CALLS] [HELD]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    
+    samples = mmap(NULL, sizeof(uint64_t) * clients * calls, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    cookies = mmap(NULL, sizeof(uint32_t) * clients * held, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (samples == MAP_FAILED || cookies == MAP_FAILED || pipe(ready_pipe) == -1 || pipe(go_pipe) == -1) {
+        perror("setup");
+        return EXIT_FAILURE;
+    }
+    
+    const uint64_t start = now_ns();
+    for (int i = 0; i < clients; i++) {
+        if (fork() == 0) {
+            close(go_pipe[1]);
+            const int r = run_client(i);
+            _exit(r < 0 ? 255 : (r > 254 ? 254 : r));
+        }
+    }
+    close(go_pipe[0]);
+    close(ready_pipe[1]);
+    
+    /* Every client is holding its inhibitions now */
+    char c;
+    int ready = 0;
+    while (ready < clients && read(ready_pipe[0], &c, 1) == 1) {
+        ready++;
+    }
+    const double elapsed = (now_ns() - start) / 1e9;
+    qsort(cookies, (size_t)clients * held, sizeof(uint32_t), cmp_u32);
+    int duplicates = 0;
+    for (int i = 1; i < clients * held; i++) {
+        duplicates += cookies[i] && cookies[i] == cookies[i - 1];
+    }
+    close(go_pipe[1]);
+    
+    int failures = 0, unavailable = 0;
+    for (int i = 0; i < clients; i++) {
+        int status;
+        wait(&status);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) == 255) {
+            unavailable++;
+        } else {
+            failures += WEXITSTATUS(status);
+        }
+    }
+    if (unavailable) {
+        fprintf(stderr, "%d clients could not connect to user bus.\n", unavailable);
+        return EXIT_FAILURE;
+    }
+    
+    const size_t n = (size_t)clients * calls;
+    qsort(samples, n, sizeof(uint64_t), cmp_u64);
+    printf("%d clients x %d calls (%d held each): %.0f calls/s\n", clients, calls, held, n / elapsed);
+    printf("latency p50 %.1f us\tp99 %.1f us\tmax %.1f us\n", samples[n / 2] / 1e3, samples[n * 99 / 100] / 1e3, samples[n - 1] / 1e3);
+    printf("%d failed calls, %d duplicated cookies\n", failures, duplicates);
+    return failures || duplicates ? EXIT_FAILURE : EXIT_SUCCESS;
+}
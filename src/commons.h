@@ -58,6 +58,7 @@ typedef struct {
     int trans_step;                         // every gamma transition step value, used when smooth GAMMA transitions are enabled
     int trans_timeout;                      // every gamma transition timeout value, used when smooth GAMMA transitions are enabled
     int long_transition;                    // flag to enable a very long smooth transition for gamma (redshift-like)
+    int mired_thres;                        // minimum temperature change (in mired) to be applied while long transitioning
     int ambient_gamma;                      // enable gamma adjustments based on ambient backlight
 } gamma_conf_t;
 
@@ -86,6 +87,9 @@ typedef struct {
     int timeout[SIZE_AC];                   // screen timeouts
     double contrib;                         // how much does screen-emitted brightness affect ambient brightness (eg 0.1)
     int samples;                            // number of samples used to compute average screen-emitted brightness
+    int max_backoff;                        // max multiplier applied to screen timeout while screen content is static
+    int decay;                              // time constant (s) of time-weighted average of screen-emitted brightness; 0 to use plain average
+    int sync_capture;                       // sample screen-emitted brightness together with each BACKLIGHT capture instead of periodically
 } screen_conf_t;
 
 typedef struct {
@@ -106,6 +110,10 @@ typedef struct {
     screen_conf_t screen_conf;
     inh_conf_t inh_conf;
     int verbose;                            // whether verbose mode is enabled
+    int timer_slack;                        // how much (ms) module timers can be delayed to be coalesced in a single wakeup
+    int logind_idle;                        // whether to use logind session IdleHint instead of clightd idle clients
+    int metrics;                            // whether to serve OpenMetrics on $XDG_RUNTIME_DIR/clight/metrics.sock
+    int control_socket;                     // whether to serve binary control protocol on $XDG_RUNTIME_DIR/clight/control.sock
     int wizard;                             // whether wizard mode is enabled
 } conf_t;
 
@@ -122,10 +130,13 @@ typedef struct {
     int inhibited;                          // whether screensaver inhibition is enabled
     int pm_inhibited;                       // whether pm_inhibition is enabled
     int sens_avail;                         // whether a sensor is currently available
+    int deep_idle;                          // whether we are in deep-idle (lid closed or display off), with non-essential timers held
+    int suspended;                          // whether system is going to sleep (between logind PrepareForSleep signals)
     enum day_states day_time;               // whether it is day or night time
     enum ac_states ac_state;                // is laptop on battery?
     enum lid_states lid_state;              // current lid state
     enum display_states display_state;      // current display state
+    int idle_state;                         // idle thresholds (enum idle_states bitmask) reached by user inactivity
     enum day_events next_event;             // next daytime event (SUNRISE or SUNSET)
     int event_time_range;
     int current_temp;                       // current GAMMA temp; specially useful when used with conf.ambient_gamma enabled
@@ -153,6 +153,7 @@ static void load_gamma_settings(config_t *cfg, gamma_conf_t *gamma_conf) {
         config_setting_lookup_int(gamma, "trans_step", &gamma_conf->trans_step);
         config_setting_lookup_int(gamma, "trans_timeout", &gamma_conf->trans_timeout);
         config_setting_lookup_bool(gamma, "long_transition", &gamma_conf->long_transition);
+        config_setting_lookup_int(gamma, "mired_threshold", &gamma_conf->mired_thres);
         config_setting_lookup_bool(gamma, "ambient_gamma", &gamma_conf->ambient_gamma);
         
         if ((gamma = config_setting_get_member(gamma, "temp"))) {
@@ -264,6 +265,9 @@ static void load_screen_settings(config_t *cfg, screen_conf_t *screen_conf) {
         config_setting_lookup_bool(screen, "disabled", &screen_conf->disabled);
         config_setting_lookup_float(screen, "contrib", &screen_conf->contrib);
         config_setting_lookup_int(screen, "num_samples", &screen_conf->samples);
+        config_setting_lookup_int(screen, "max_backoff", &screen_conf->max_backoff);
+        config_setting_lookup_int(screen, "decay", &screen_conf->decay);
+        config_setting_lookup_bool(screen, "sync_capture", &screen_conf->sync_capture);
         
         config_setting_t *timeouts;
         if ((timeouts = config_setting_get_member(screen, "timeouts"))) {
@@ -301,6 +305,10 @@ int read_config(enum CONFIG file, char *config_file) {
     config_init(&cfg);
     if (config_read_file(&cfg, config_file) == CONFIG_TRUE) {
         config_lookup_bool(&cfg, "verbose", &conf.verbose);
+        config_lookup_int(&cfg, "timer_slack", &conf.timer_slack);
+        config_lookup_bool(&cfg, "logind_idle", &conf.logind_idle);
+        config_lookup_bool(&cfg, "metrics", &conf.metrics);
+        config_lookup_bool(&cfg, "control_socket", &conf.control_socket);
         
         load_backlight_settings(&cfg, &conf.bl_conf);
         load_sensor_settings(&cfg, &conf.sens_conf);
@@ -410,6 +418,9 @@ static void store_gamma_settings(config_t *cfg, gamma_conf_t *gamma_conf) {
     setting = config_setting_add(gamma, "long_transition", CONFIG_TYPE_BOOL);
     config_setting_set_bool(setting, gamma_conf->long_transition);
     
+    setting = config_setting_add(gamma, "mired_threshold", CONFIG_TYPE_INT);
+    config_setting_set_int(setting, gamma_conf->mired_thres);
+    
     setting = config_setting_add(gamma, "ambient_gamma", CONFIG_TYPE_BOOL);
     config_setting_set_bool(setting, gamma_conf->ambient_gamma);
     
@@ -485,6 +496,15 @@ static void store_screen_settings(config_t *cfg, screen_conf_t *screen_conf) {
     setting = config_setting_add(screen, "contrib", CONFIG_TYPE_FLOAT);
     config_setting_set_float(setting, screen_conf->contrib);
     
+    setting = config_setting_add(screen, "max_backoff", CONFIG_TYPE_INT);
+    config_setting_set_int(setting, screen_conf->max_backoff);
+    
+    setting = config_setting_add(screen, "decay", CONFIG_TYPE_INT);
+    config_setting_set_int(setting, screen_conf->decay);
+    
+    setting = config_setting_add(screen, "sync_capture", CONFIG_TYPE_BOOL);
+    config_setting_set_bool(setting, screen_conf->sync_capture);
+    
     setting = config_setting_add(screen, "timeouts", CONFIG_TYPE_ARRAY);
     for (int i = 0; i < SIZE_AC; i++) {
         config_setting_set_int_elem(setting, -1, screen_conf->timeout[i]);
@@ -515,6 +535,18 @@ int store_config(enum CONFIG file) {
     config_setting_t *setting = config_setting_add(cfg.root, "verbose", CONFIG_TYPE_BOOL);
     config_setting_set_bool(setting, conf.verbose);
     
+    setting = config_setting_add(cfg.root, "timer_slack", CONFIG_TYPE_INT);
+    config_setting_set_int(setting, conf.timer_slack);
+    
+    setting = config_setting_add(cfg.root, "logind_idle", CONFIG_TYPE_BOOL);
+    config_setting_set_bool(setting, conf.logind_idle);
+    
+    setting = config_setting_add(cfg.root, "metrics", CONFIG_TYPE_BOOL);
+    config_setting_set_bool(setting, conf.metrics);
+    
+    setting = config_setting_add(cfg.root, "control_socket", CONFIG_TYPE_BOOL);
+    config_setting_set_bool(setting, conf.control_socket);
+    
     store_backlight_settings(&cfg, &conf.bl_conf);
     store_sensors_settings(&cfg, &conf.sens_conf);
     store_kbd_settings(&cfg, &conf.kbd_conf);
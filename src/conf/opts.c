@@ -73,6 +73,7 @@ static void init_gamma_opts(gamma_conf_t *gamma_conf) {
     gamma_conf->temp[NIGHT] = 4000;
     gamma_conf->trans_step = 50;
     gamma_conf->trans_timeout = 300;
+    gamma_conf->mired_thres = 10;
 }
 
 static void init_daytime_opts(daytime_conf_t *day_conf) {
@@ -101,6 +102,7 @@ static void init_screen_opts(screen_conf_t *screen_conf) {
     screen_conf->timeout[ON_BATTERY] = -1; // disabled on battery by default
     screen_conf->contrib = 0.1;
     screen_conf->samples = 10;
+    screen_conf->max_backoff = 8;
 }
 
 /*
@@ -351,6 +353,11 @@ static void check_gamma_conf(gamma_conf_t *gamma_conf) {
         WARN("Wrong gamma_trans_timeout value. Resetting default value.\n");
         gamma_conf->trans_timeout = 300;
     }
+    
+    if (gamma_conf->mired_thres <= 0) {
+        WARN("Wrong gamma mired_threshold value. Resetting default value.\n");
+        gamma_conf->mired_thres = 10;
+    }
 }
 
 static void check_daytime_conf(daytime_conf_t *day_conf) {
@@ -449,6 +456,16 @@ static void check_screen_conf(screen_conf_t *screen_conf) {
         WARN("Wrong screen_samples value. Resetting default value.\n");
         screen_conf->samples = 10;
     }
+    
+    if (screen_conf->max_backoff < 1) {
+        WARN("Wrong screen max_backoff value. Resetting default value.\n");
+        screen_conf->max_backoff = 8;
+    }
+    
+    if (screen_conf->decay < 0) {
+        WARN("Wrong screen decay value. Resetting default value.\n");
+        screen_conf->decay = 0;
+    }
 }
 
 static void check_inh_conf(inh_conf_t *inh_conf) {
@@ -465,6 +482,11 @@ static void check_inh_conf(inh_conf_t *inh_conf) {
  * in case of wrong options set.
  */
 static void check_conf(void) {
+    if (conf.timer_slack < 0) {
+        WARN("Wrong timer_slack value. Resetting default value.\n");
+        conf.timer_slack = 0;
+    }
+    
     /* Wizard mode; disable everything except backlight */
     if (conf.wizard) {
         conf.bl_conf.no_auto_calib = true;
@@ -0,0 +1,100 @@
+#pragma once
+
+/*
+ * Clight binary control protocol, served by INTERFACE on
+ * $XDG_RUNTIME_DIR/CLIGHT_CTL_SOCK when control_socket conf is enabled.
+ *
+ * It is a lightweight alternative to the bus api for hot operations,
+ * eg: backlight hotkeys: a client keeps a single SOCK_SEQPACKET connection open,
+ * and each request gets exactly one fixed-size response, in order.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define CLIGHT_CTL_MAGIC            0x434c4354      // "CLCT"
+#define CLIGHT_CTL_VERSION          1               // bumped on any layout change
+#define CLIGHT_CTL_SOCK             "clight/control.sock"
+
+enum clight_ctl_ops {
+    CLIGHT_CTL_GET_STATE,           // just reply with current state
+    CLIGHT_CTL_INC_BL,              // arg: backlight pct to add, in (0, 1)
+    CLIGHT_CTL_DEC_BL,              // arg: backlight pct to remove, in (0, 1)
+    CLIGHT_CTL_CAPTURE,             // flags: CLIGHT_CTL_RESET_TIMER, CLIGHT_CTL_CAPTURE_ONLY
+    CLIGHT_CTL_INHIBIT              // arg: 1 to inhibit, 0 to drop inhibition
+};
+
+/* CLIGHT_CTL_CAPTURE flags */
+#define CLIGHT_CTL_RESET_TIMER      0x01
+#define CLIGHT_CTL_CAPTURE_ONLY     0x02
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t op;                    // enum clight_ctl_ops
+    uint32_t flags;
+    uint32_t padding;
+    double arg;
+} clight_ctl_req_t;
+
+/*
+ * Requests are asynchronous in Clight (eg: backlight is changed by BACKLIGHT module),
+ * thus state is the one found when request was received;
+ * a following CLIGHT_CTL_GET_STATE will report the new one.
+ */
+typedef struct {
+    int32_t status;                 // 0 on success, -errno on failure
+    int32_t ac_state;               // enum ac_states
+    int32_t display_state;          // enum display_states bitmask
+    int32_t lid_state;              // enum lid_states
+    int32_t inhibited;
+    int32_t temp;
+    double bl_pct;
+    double kbd_pct;
+    double ambient_br;
+} clight_ctl_resp_t;
+
+/* Connect to Clight control socket. Returns socket fd, or -1 on error */
+static inline int clight_ctl_open(void) {
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if (!dir) {
+        return -1;
+    }
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s", dir, CLIGHT_CTL_SOCK);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd != -1 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+static inline void clight_ctl_close(int fd) {
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+/*
+ * Send a request and wait for its response.
+ * Returns response status, or -errno on communication errors.
+ */
+static inline int clight_ctl_call(int fd, enum clight_ctl_ops op, uint32_t flags, double arg, clight_ctl_resp_t *resp) {
+    const clight_ctl_req_t req = { CLIGHT_CTL_MAGIC, CLIGHT_CTL_VERSION, op, flags, 0, arg };
+    if (send(fd, &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req)) {
+        return -errno;
+    }
+    const ssize_t len = recv(fd, resp, sizeof(*resp), 0);
+    if (len != sizeof(*resp)) {
+        return len < 0 ? -errno : -EPROTO;
+    }
+    return resp->status;
+}
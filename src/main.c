@@ -23,6 +23,8 @@
 
 #include <glob.h>
 #include "opts.h"
+#include "stats.h"
+#include "relay.h"
 
 static int init(int argc, char *argv[]);
 static void init_state(void);
@@ -47,10 +49,16 @@ int main(int argc, char *argv[]) {
         if (conf.bl_conf.disabled && conf.dim_conf.disabled && conf.dpms_conf.disabled && conf.gamma_conf.disabled) {
             WARN("No functional module running. Leaving...\n");
         } else {
+            if (!conf.wizard && relay_start() != 0) {
+                WARN("Failed to start %s context: %s.\n", IFACE_CTX, strerror(errno));
+            }
             ret = modules_loop();
+            relay_stop();
+            log_stats();
         }
     }
     close_log();
+    stats_destroy();
     return ret;
 }
 
@@ -66,7 +74,8 @@ static int init(int argc, char *argv[]) {
      * a debug message before dying
      */
     signal(SIGSEGV, sigsegv_handler);
-        
+    
+    stats_init();
     open_log();
     /* We want any issue while parsing config to be logged */
     if (init_opts(argc, argv) != 0) {
@@ -1,5 +1,6 @@
 #include "bus.h"
 #include "my_math.h"
+#include "stats.h"
 
 enum backlight_pause { UNPAUSED = 0, DISPLAY = 0x01, SENSOR = 0x02, AUTOCALIB = 0x04, LID = 0x08 };
 
@@ -8,6 +9,10 @@ static void receive_paused(const msg_t *const msg, const void* userdata);
 static int parse_bus_reply(sd_bus_message *reply, const char *member, void *userdata);
 static int is_sensor_available(void);
 static void do_capture(bool reset_timer, bool capture_only);
+static void on_screen_sampled(int r, void *userdata);
+static void end_capture(int r, bool reset_timer, bool capture_only);
+static bool is_screen_synced(void);
+static void set_screen_comp(double screen_br);
 static void set_new_backlight(const double perc);
 static void set_backlight_level(const double pct, const int is_smooth, const double step, const int timeout);
 static int capture_frames_brightness(void);
@@ -20,23 +25,37 @@ static void time_callback(int old_val, int is_event);
 static int on_sensor_change(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 static int get_current_timeout(void);
 static void on_lid_update(void);
+static void on_suspend(bool suspended);
+static void ack_suspend(const msg_t *const msg);
 static void pause_mod(enum backlight_pause type);
 static void resume_mod(enum backlight_pause type);
 
-static int bl_fd = -1;
+static int bl_timer = -1;
 static int paused_state;
 static sd_bus_slot *slot;
+static const self_t *sleep_ref, *screen_ref;
+static bus_pending screen_call;     // screen sample taken together with current capture, if any
+static struct {
+    int r;
+    bool reset_timer;
+    bool capture_only;
+} pending_capture;                  // capture waiting for its screen sample
 
 DECLARE_MSG(bl_msg, BL_UPD);
 DECLARE_MSG(amb_msg, AMBIENT_BR_UPD);
 DECLARE_MSG(capture_req, CAPTURE_REQ);
 DECLARE_MSG(sens_msg, SENS_UPD);
+DECLARE_MSG(screen_msg, SCR_BL_UPD);
+DECLARE_MSG(captured_msg, CAPTURE_UPD);
+DECLARE_MSG(suspend_ack, SUSPEND_ACK_REQ);
 
 MODULE("BACKLIGHT");
 
 static void init(void) {
     capture_req.capture.reset_timer = true;
     capture_req.capture.capture_only = false;
+    m_ref("SLEEP", &sleep_ref);
+    m_ref("SCREEN", &screen_ref);
     
     /* Compute polynomial best-fit parameters for each loaded sensor config */
     interface_curve_callback(NULL, 0, ON_AC);
@@ -52,6 +71,7 @@ static void init(void) {
     M_SUB(CURVE_REQ);
     M_SUB(NO_AUTOCALIB_REQ);
     M_SUB(BL_REQ);
+    M_SUB(SUSPEND_UPD);
     m_become(waiting_init);
 }
 
@@ -64,12 +84,11 @@ static bool evaluate(void) {
 }
 
 static void destroy(void) {
+    cancel_call(&screen_call);
     if (slot) {
         slot = sd_bus_slot_unref(slot);
     }
-    if (bl_fd >= 0) {
-        close(bl_fd);
-    }
+    timer_free(bl_timer);
 }
 
 static void receive_waiting_init(const msg_t *const msg, UNUSED const void* userdata) {
@@ -84,6 +103,15 @@ static void receive_waiting_init(const msg_t *const msg, UNUSED const void* user
     case DAYTIME_UPD:
         ok |= DAYTIME_STARTED;
         break;
+    case CAPTURE_REQ:
+        /* Let waiters know no capture will happen */
+        captured_msg.captured.ok = false;
+        M_PUB(&captured_msg);
+        break;
+    case SUSPEND_UPD:
+        /* Nothing to stop yet */
+        ack_suspend(msg);
+        break;
     default:
         break;
     }
@@ -94,8 +122,7 @@ static void receive_waiting_init(const msg_t *const msg, UNUSED const void* user
         SYSBUS_ARG(args, CLIGHTD_SERVICE, "/org/clightd/clightd/Sensor", "org.clightd.clightd.Sensor", "Changed");
         add_match(&args, &slot, on_sensor_change);
                 
-        bl_fd = start_timer(CLOCK_BOOTTIME, 0, get_current_timeout() > 0);
-        m_register_fd(bl_fd, false, NULL);
+        bl_timer = timer_new(self(), "backlight", 0, get_current_timeout() > 0);
         
         /* Eventually pause backlight if sensor is not available */
         on_sensor_change(NULL, NULL, NULL);
@@ -124,8 +151,7 @@ static void receive_waiting_init(const msg_t *const msg, UNUSED const void* user
 
 static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     switch (MSG_TYPE()) {
-    case FD_UPD:
-        read_timer(msg->fd_msg->fd);
+    case TIMER_UPD:
         M_PUB(&capture_req);
         break;
     case UPOWER_UPD:
@@ -143,6 +169,12 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     case LID_UPD:
         on_lid_update();
         break;
+    case SUSPEND_UPD: {
+        suspend_upd *up = (suspend_upd *)MSG_DATA();
+        on_suspend(up->new);
+        ack_suspend(msg);
+        break;
+    }
     case BL_TO_REQ: {
         timeout_upd *up = (timeout_upd *)MSG_DATA();
         if (VALIDATE_REQ(up)) {
@@ -184,7 +216,7 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
 }
 
 static void receive_paused(const msg_t *const msg, UNUSED const void* userdata) {
-    /* In paused state we have deregistered our fd, thus we can only receive PubSub messages */
+    /* In paused state our timer is paused too, thus we can only receive PubSub messages */
     switch (MSG_TYPE()) {
     case UPOWER_UPD:
         upower_callback();
@@ -210,9 +242,18 @@ static void receive_paused(const msg_t *const msg, UNUSED const void* userdata)
     }
     case CAPTURE_REQ: {
         capture_upd *up = (capture_upd *)MSG_DATA();
-        /* In paused state check that we're not dimmed/dpms and sensor is available */
-        if (VALIDATE_REQ(up) && !state.display_state && state.sens_avail) {
-            do_capture(up->reset_timer, up->capture_only);
+        /* 
+         * In paused state check that we're not dimmed/dpms and sensor is available;
+         * SLEEP resume refresh is skipped: our owner (eg: DIMMER) is in charge of backlight.
+         */
+        if (VALIDATE_REQ(up) && msg->ps_msg->sender != sleep_ref) {
+            if (!state.display_state && state.sens_avail) {
+                do_capture(up->reset_timer, up->capture_only);
+            } else {
+                /* Let waiters know no capture will happen */
+                captured_msg.captured.ok = false;
+                M_PUB(&captured_msg);
+            }
         }
         break;
     }
@@ -230,6 +271,10 @@ static void receive_paused(const msg_t *const msg, UNUSED const void* userdata)
         }
         break;
     }
+    case SUSPEND_UPD:
+        /* Timer is paused anyway, and backlight is not ours */
+        ack_suspend(msg);
+        break;
     case BL_REQ: {
         /* In paused state check that we're not dimmed/dpms */
         bl_upd *up = (bl_upd *)MSG_DATA();
@@ -270,6 +315,8 @@ static int parse_bus_reply(sd_bus_message *reply, const char *member, void *user
             amb_msg.bl.new = state.ambient_br;
             M_PUB(&amb_msg);
         }
+    } else if (!strcmp(member, "GetEmittedBrightness")) {
+        r = sd_bus_message_read(reply, "d", userdata);
     }
     return r;
 }
@@ -282,7 +329,50 @@ static int is_sensor_available(void) {
 }
 
 static void do_capture(bool reset_timer, bool capture_only) {
-    if (!capture_frames_brightness() && !capture_only) {
+    if (screen_call.slot) {
+        /* Previous capture is still waiting for its screen sample: it will serve this request too */
+        pending_capture.reset_timer |= reset_timer;
+        pending_capture.capture_only &= capture_only;
+        return;
+    }
+    
+    /* 
+     * When SCREEN is synced with captures, 
+     * sample screen-emitted brightness while camera is capturing.
+     * Its reply is dispatched by BUS once we are done, completing the capture.
+     */
+    static double screen_br;
+    static SYSBUS_ARG_REPLY(screen_args, parse_bus_reply, &screen_br, CLIGHTD_SERVICE, "/org/clightd/clightd/Screen", "org.clightd.clightd.Screen", "GetEmittedBrightness");
+    const bool sync_screen = is_screen_synced() && 
+                            call_async(&screen_args, &screen_call, on_screen_sampled, "ss", state.display, state.xauthority) == 0;
+    
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const int r = capture_frames_brightness();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    stats_observe("capture", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    stats_count(r == 0 ? "capture:ok" : "capture:failed");
+    
+    if (sync_screen) {
+        pending_capture.r = r;
+        pending_capture.reset_timer = reset_timer;
+        pending_capture.capture_only = capture_only;
+    } else {
+        end_capture(r, reset_timer, capture_only);
+    }
+}
+
+static void on_screen_sampled(int r, void *userdata) {
+    if (r == 0) {
+        set_screen_comp(*(double *)userdata);
+    }
+    /* Display may have been dimmed meanwhile: backlight is not ours then */
+    end_capture(pending_capture.r, pending_capture.reset_timer, 
+                pending_capture.capture_only || state.display_state);
+}
+
+static void end_capture(int r, bool reset_timer, bool capture_only) {
+    if (!r && !capture_only) {
         /* Account for screen-emitted brightness */
         const double compensated_br = clamp(state.ambient_br - state.screen_comp, 1, 0);
         if (compensated_br >= conf.bl_conf.shutter_threshold) {
@@ -292,15 +382,41 @@ static void do_capture(bool reset_timer, bool capture_only) {
             } else {
                 INFO("Ambient brightness: %.3lf -> Backlight pct: %.3lf.\n", state.ambient_br, state.current_bl_pct);
             }
-        } else if (state.screen_comp > 0.0) {
-            INFO("Ambient brightness: %.3lf (-%.3lf screen compensation) -> Clogged capture detected.\n", state.ambient_br, state.screen_comp);
         } else {
-            INFO("Ambient brightness: %.3lf -> Clogged capture detected.\n", state.ambient_br);
+            stats_count("capture:clogged");
+            if (state.screen_comp > 0.0) {
+                INFO("Ambient brightness: %.3lf (-%.3lf screen compensation) -> Clogged capture detected.\n", state.ambient_br, state.screen_comp);
+            } else {
+                INFO("Ambient brightness: %.3lf -> Clogged capture detected.\n", state.ambient_br);
+            }
         }
     }
 
     if (reset_timer) {
-        set_timeout(get_current_timeout(), 0, bl_fd, 0);
+        timer_set(bl_timer, get_current_timeout(), 0);
+    }
+    
+    captured_msg.captured.ok = r == 0;
+    captured_msg.captured.ambient_br = state.ambient_br;
+    captured_msg.captured.compensated_br = clamp(state.ambient_br - state.screen_comp, 1, 0);
+    captured_msg.captured.bl_pct = state.current_bl_pct;
+    M_PUB(&captured_msg);
+}
+
+/* Screen-emitted brightness is only available on X, while SCREEN is running */
+static inline bool is_screen_synced(void) {
+    return screen_ref && module_is(screen_ref, RUNNING) && state.display && state.xauthority &&
+            !conf.screen_conf.disabled && conf.screen_conf.sync_capture &&
+            conf.screen_conf.timeout[state.ac_state] > 0 && conf.screen_conf.contrib > 0;
+}
+
+/* Use screen-emitted brightness sampled together with current capture as compensation */
+static void set_screen_comp(double screen_br) {
+    screen_msg.bl.old = state.screen_comp;
+    state.screen_comp = screen_br * conf.screen_conf.contrib;
+    if (screen_msg.bl.old != state.screen_comp) {
+        screen_msg.bl.new = state.screen_comp;
+        M_PUB(&screen_msg);
     }
 }
 
@@ -310,12 +426,21 @@ static void set_new_backlight(const double perc) {
                     + state.fit_parameters[state.ac_state][1] * perc 
                     + state.fit_parameters[state.ac_state][2] * pow(perc, 2);
     const double new_br_pct =  clamp(b, 1, 0);
-
+    
+    /* 
+     * Captures often map to the same level: only account for it,
+     * as backlight may have been changed by someone else meanwhile.
+     */
+    if (new_br_pct == state.current_bl_pct) {
+        stats_count("backlight:redundant");
+    }
     set_backlight_level(new_br_pct, !conf.bl_conf.no_smooth, 
                         conf.bl_conf.trans_step, conf.bl_conf.trans_timeout);
 }
 
 static void set_backlight_level(const double pct, const int is_smooth, const double step, const int timeout) {
+    stats_count("backlight:issued");
+    
     int ok = 0;
     SYSBUS_ARG_REPLY(args, parse_bus_reply, &ok, CLIGHTD_SERVICE, "/org/clightd/clightd/Backlight", "org.clightd.clightd.Backlight", "SetAll");
     
@@ -341,7 +466,7 @@ static int capture_frames_brightness(void) {
 
 /* Callback on upower ac state changed signal */
 static void upower_callback(void) {
-    set_timeout(0, get_current_timeout() > 0, bl_fd, 0);
+    timer_set(bl_timer, 0, get_current_timeout() > 0);
 }
 
 /* Callback on "NoAutoCalib" bus exposed writable property */
@@ -378,7 +503,7 @@ static void interface_timeout_callback(timeout_upd *up) {
         if (up->state == state.ac_state && 
             (up->daytime == state.day_time || (state.in_event && up->daytime == IN_EVENT))) {
             
-            reset_timer(bl_fd, old, get_current_timeout());
+            timer_reset(bl_timer, old, get_current_timeout());
         }
     } else {
         WARN("Failed to validate timeout request.\n");
@@ -407,7 +532,7 @@ static void time_callback(int old_val, int is_event) {
          */
         old_timeout = conf.bl_conf.timeout[state.ac_state][state.in_event ? state.day_time : IN_EVENT];
     }
-    reset_timer(bl_fd, old_timeout, get_current_timeout());
+    timer_reset(bl_timer, old_timeout, get_current_timeout());
 }
 
 /* Callback on SensorChanged clightd signal */
@@ -449,8 +574,8 @@ static void pause_mod(enum backlight_pause type) {
     paused_state |= type;
     if (old_paused == UNPAUSED && paused_state != UNPAUSED) {
         m_become(paused);
-        /* Properly deregister our fd while paused */
-        m_deregister_fd(bl_fd);
+        /* Hold our timer expirations while paused */
+        timer_pause(bl_timer, true);
     }
 }
 
@@ -459,7 +584,26 @@ static void resume_mod(enum backlight_pause type) {
     paused_state &= ~type;
     if (old_paused != UNPAUSED && paused_state == UNPAUSED) {
         m_unbecome();
-        /* Register back our fd on resume */
-        m_register_fd(bl_fd, false, NULL);
+        /* Deliver back our timer expirations on resume */
+        timer_pause(bl_timer, false);
     }
 }
+
+/*
+ * Before sleeping, stop any ongoing smooth transition by jumping to its target.
+ * On resume, SLEEP requests a capture once DAYTIME is up to date.
+ * While paused, our owner (eg: DIMMER) is in charge of backlight, and timer is paused anyway.
+ */
+static void on_suspend(bool suspended) {
+    if (suspended && !conf.bl_conf.no_smooth) {
+        int ok = 0;
+        SYSBUS_ARG_REPLY(args, parse_bus_reply, &ok, CLIGHTD_SERVICE, "/org/clightd/clightd/Backlight", "org.clightd.clightd.Backlight", "SetAll");
+        call(&args, "d(bdu)s", state.current_bl_pct, false, 0.0, 0, conf.bl_conf.screen_path);
+    }
+}
+
+/* Let SLEEP know we are done with a SUSPEND_UPD */
+static void ack_suspend(const msg_t *const msg) {
+    suspend_ack.suspend.new = ((suspend_upd *)MSG_DATA())->new;
+    M_PUB(&suspend_ack);
+}
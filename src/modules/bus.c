@@ -1,11 +1,21 @@
 #include "bus.h"
+#include "stats.h"
+
+#define ASYNC_CALL_TIMEOUT  5      // s; async calls fail if no reply is received meanwhile
 
 #define GET_BUS(a)  sd_bus *tmp = a->bus; if (!tmp) { tmp = a->type == USER_BUS ? userbus : sysbus; } if (!tmp) { return -1; }
 
 static void free_bus_structs(sd_bus_error *err, sd_bus_message *m, sd_bus_message *reply);
 static int check_err(int *r, sd_bus_error *err, const char *caller);
+static int on_bus_msg(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int new_call(const bus_args *a, sd_bus *bus, sd_bus_message **m, sd_bus_error *error, const char *signature, va_list args);
+static int on_async_reply(sd_bus_message *reply, void *userdata, sd_bus_error *ret_error);
+static void process_bus(sd_bus *b);
+static void schedule_dispatch(const bus_args *a);
 
 static sd_bus *sysbus, *userbus;
+static int dispatch_timer = -1;
+static int pending_calls;       // async calls whose reply has not been dispatched yet
 
 MODULE("BUS");
 
@@ -23,6 +33,10 @@ static void init(void) {
         ERROR("BUS: Failed to connect to user bus\n");
     }
     
+    /* Account any received signal or method call as a wakeup */
+    sd_bus_add_filter(sysbus, NULL, on_bus_msg, NULL);
+    sd_bus_add_filter(userbus, NULL, on_bus_msg, NULL);
+    
     sd_bus_process(sysbus, NULL);
     sd_bus_process(userbus, NULL);
     
@@ -31,6 +45,11 @@ static void init(void) {
 
     m_register_fd(dup(bus_fd), true, sysbus);
     m_register_fd(dup(userbus_fd), true, userbus);
+    
+    /* Only armed while async replies are pending */
+    dispatch_timer = timer_new(self(), "bus-dispatch", 0, 0);
+    timer_set_essential(dispatch_timer, true);
+    timer_set_slack(dispatch_timer, 0);
 }
 
 static bool check(void) {
@@ -42,29 +61,60 @@ static bool evaluate(void) {
 }
 
 static void destroy(void) {
+    timer_free(dispatch_timer);
     if (sysbus) {
         sysbus = sd_bus_flush_close_unref(sysbus);
     }
+    if (userbus) {
+        userbus = sd_bus_flush_close_unref(userbus);
+    }
 }
 
 static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     switch (MSG_TYPE()) {
-    case FD_UPD: {
-        sd_bus *b = (sd_bus *)msg->fd_msg->userptr;
-        int r;
-        do {
-            r = sd_bus_process(b, NULL);
-        } while (r > 0);
-        if (r == -ENOTCONN || r == -ECONNRESET) {
-            modules_quit(r);
+    case FD_UPD:
+        process_bus((sd_bus *)msg->fd_msg->userptr);
+        break;
+    case TIMER_UPD:
+        /*
+         * Messages queued by a blocking call never make our fds readable;
+         * nor do expired async calls, that sd-bus only fails while processing.
+         */
+        process_bus(sysbus);
+        process_bus(userbus);
+        if (pending_calls > 0) {
+            timer_set(dispatch_timer, ASYNC_CALL_TIMEOUT, 0);
         }
         break;
-    }
     default:
         break;
     }
 }
 
+static void process_bus(sd_bus *b) {
+    int r;
+    do {
+        r = sd_bus_process(b, NULL);
+    } while (r > 0);
+    if (r == -ENOTCONN || r == -ECONNRESET) {
+        modules_quit(r);
+    }
+}
+
+static int on_bus_msg(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
+    const char *member = sd_bus_message_get_member(m);
+    if (member) {
+        const char *iface = sd_bus_message_get_interface(m);
+        char source[256];
+        snprintf(source, sizeof(source), "bus:%s.%s", iface ? iface : "unknown", member);
+        stats_wakeup(source);
+    } else {
+        stats_wakeup("bus:reply");
+    }
+    /* Let message be dispatched */
+    return 0;
+}
+
 /*
  * Call a method on bus and store its result of type userptr_type in userptr.
  */
@@ -72,9 +122,13 @@ int call(const bus_args *a, const char *signature, ...) {
     sd_bus_error error = SD_BUS_ERROR_NULL;
     sd_bus_message *m = NULL, *reply = NULL;
     GET_BUS(a);
+    stats_count("bus:calls");
 
-    int r = sd_bus_message_new_method_call(tmp, &m, a->service, a->path, a->interface, a->member);
-    if (check_err(&r, &error, a->caller)) {
+    va_list args;
+    va_start(args, signature);
+    int r = new_call(a, tmp, &m, &error, signature, args);
+    va_end(args);
+    if (r < 0) {
         goto finish;
     }
 
@@ -83,12 +137,82 @@ int call(const bus_args *a, const char *signature, ...) {
         goto finish;
     }
 
-    if (signature) {
-        va_list args;
-        va_start(args, signature);
+    /* Check if we need to wait for a response message */
+    if (a->reply_cb != NULL) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        r = sd_bus_call(tmp, m, 0, &error, &reply);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        stats_observe("bus_call", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+        schedule_dispatch(a);
+        if (check_err(&r, &error, a->caller)) {
+            goto finish;
+        }
+        r = a->reply_cb(reply, a->member, a->reply_userdata);
+    } else {
+        r = sd_bus_send(tmp, m, NULL);
+    }
+    check_err(&r, &error, a->caller);
+
+finish:
+    free_bus_structs(&error, m, reply);
+    return r;
+}
+
+/*
+ * Call a method on bus without waiting for its reply:
+ * once it is received, BUS parses it through a->reply_cb, then calls done_cb.
+ * done_cb is called with -1 if no reply is received in ASYNC_CALL_TIMEOUT s.
+ * Both a and p must stay valid until then, or until cancel_call().
+ */
+int call_async(const bus_args *a, bus_pending *p, bus_done_cb done_cb, const char *signature, ...) {
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    sd_bus_message *m = NULL;
+    GET_BUS(a);
+    stats_count("bus:calls");
+
+    memset(p, 0, sizeof(bus_pending));
+    p->args = a;
+    p->done_cb = done_cb;
+    
+    va_list args;
+    va_start(args, signature);
+    int r = new_call(a, tmp, &m, &error, signature, args);
+    va_end(args);
+    if (r == 0) {
+        r = sd_bus_call_async(tmp, &p->slot, m, on_async_reply, p, ASYNC_CALL_TIMEOUT * 1000 * 1000);
+        if (!check_err(&r, &error, a->caller)) {
+            pending_calls++;
+            /* Make sure it gets failed once it expires */
+            timer_set(dispatch_timer, ASYNC_CALL_TIMEOUT, 0);
+        }
+    }
+    free_bus_structs(&error, m, NULL);
+    return r;
+}
+
+/*
+ * Drop a pending async call: its done_cb won't be called.
+ */
+void cancel_call(bus_pending *p) {
+    if (p->slot) {
+        p->slot = sd_bus_slot_unref(p->slot);
+        pending_calls--;
+    }
+}
 
+/*
+ * Create a new method call message, appending signature args to it.
+ */
+static int new_call(const bus_args *a, sd_bus *bus, sd_bus_message **m, sd_bus_error *error, const char *signature, va_list args) {
+    int r = sd_bus_message_new_method_call(bus, m, a->service, a->path, a->interface, a->member);
+    if (check_err(&r, error, a->caller)) {
+        return r;
+    }
+
+    if (signature) {
 #if LIBSYSTEMD_VERSION >= 234
-        sd_bus_message_appendv(m, signature, args);
+        sd_bus_message_appendv(*m, signature, args);
 #else
         int i = 0;
         int size_array = 0;
@@ -97,19 +221,19 @@ int call(const bus_args *a, const char *signature, ...) {
                 case SD_BUS_TYPE_STRING:
                 case SD_BUS_TYPE_OBJECT_PATH:{
                     char *val = va_arg(args, char *);
-                    r = sd_bus_message_append_basic(m, signature[i], val);
+                    r = sd_bus_message_append_basic(*m, signature[i], val);
                     break;
                 }
                 case SD_BUS_TYPE_INT32:
                 case SD_BUS_TYPE_UINT32:
                 case SD_BUS_TYPE_BOOLEAN: {
                     int val = va_arg(args, int);
-                    r = sd_bus_message_append_basic(m, signature[i], &val);
+                    r = sd_bus_message_append_basic(*m, signature[i], &val);
                     break;
                 }
                 case SD_BUS_TYPE_DOUBLE: {
                     double val = va_arg(args, double);
-                    r = sd_bus_message_append_basic(m, signature[i], &val);
+                    r = sd_bus_message_append_basic(*m, signature[i], &val);
                     break;
                 }
                 case SD_BUS_TYPE_STRUCT_BEGIN: {
@@ -117,18 +241,18 @@ int call(const bus_args *a, const char *signature, ...) {
                     if (ptr) {
                         char str[30] = {0};
                         strncpy(str, signature + i + 1, strlen(signature + i + 1) - strlen(ptr));
-                        r = sd_bus_message_open_container(m, SD_BUS_TYPE_STRUCT, str);
+                        r = sd_bus_message_open_container(*m, SD_BUS_TYPE_STRUCT, str);
                     }
                     break;
                 }
                 case SD_BUS_TYPE_STRUCT_END:
-                    r = sd_bus_message_close_container(m);
+                    r = sd_bus_message_close_container(*m);
                     break;
                 case SD_BUS_TYPE_ARRAY: {
                     char type[5] = {0};
                     i++;
                     strncpy(type, &signature[i], 1);
-                    r = sd_bus_message_open_container(m, SD_BUS_TYPE_ARRAY, type);
+                    r = sd_bus_message_open_container(*m, SD_BUS_TYPE_ARRAY, type);
                     size_array = va_arg(args, int) + 1; // + 1 because size_array-- below
                     break;
                 }
@@ -137,14 +261,14 @@ int call(const bus_args *a, const char *signature, ...) {
                     break;
             }
 
-            if (check_err(&r, &error, a->caller)) {
-                goto finish;
+            if (check_err(&r, error, a->caller)) {
+                return r;
             }
             
             /* If inside an array, decrement array counter */
             if (size_array) {
                 if (--size_array == 0) {
-                    r = sd_bus_message_close_container(m);
+                    r = sd_bus_message_close_container(*m);
                 }
             }
             
@@ -154,23 +278,35 @@ int call(const bus_args *a, const char *signature, ...) {
             }
         }
 #endif
-        va_end(args);
     }
-    /* Check if we need to wait for a response message */
-    if (a->reply_cb != NULL) {
-        r = sd_bus_call(tmp, m, 0, &error, &reply);
-        if (check_err(&r, &error, a->caller)) {
-            goto finish;
-        }
-        r = a->reply_cb(reply, a->member, a->reply_userdata);
-    } else {
-        r = sd_bus_send(tmp, m, NULL);
+    return 0;
+}
+
+/*
+ * Blocking calls queue any other message received meanwhile, pending replies included:
+ * let BUS dispatch them straight away. INTERFACE buses are not ours.
+ */
+static void schedule_dispatch(const bus_args *a) {
+    if (!a->bus && pending_calls > 0) {
+        timer_set(dispatch_timer, 0, 1);
     }
-    check_err(&r, &error, a->caller);
+}
 
-finish:
-    free_bus_structs(&error, m, reply);
-    return r;
+static int on_async_reply(sd_bus_message *reply, void *userdata, UNUSED sd_bus_error *ret_error) {
+    bus_pending *p = (bus_pending *)userdata;
+    p->slot = sd_bus_slot_unref(p->slot);
+    pending_calls--;
+    
+    int r;
+    const sd_bus_error *err = sd_bus_message_get_error(reply);
+    if (err) {
+        DEBUG("%s(): %s\n", p->args->caller, err->message);
+        r = -1;
+    } else {
+        r = p->args->reply_cb(reply, p->args->member, p->args->reply_userdata);
+    }
+    p->done_cb(r, p->args->reply_userdata);
+    return 0;
 }
 
 /*
@@ -194,6 +330,7 @@ int add_match(const bus_args *a, sd_bus_slot **slot, sd_bus_message_handler_t cb
  */
 int set_property(const bus_args *a, const char type, const void *value) {
     GET_BUS(a);
+    stats_count("bus:calls");
     sd_bus_error error = SD_BUS_ERROR_NULL;
     int r = 0;
 
@@ -208,6 +345,7 @@ int set_property(const bus_args *a, const char type, const void *value) {
             WARN("Wrong signature in bus call: %c.\n", type);
             break;
     }
+    schedule_dispatch(a);
     check_err(&r, &error, a->caller);
     free_bus_structs(&error, NULL, NULL);
     return r;
@@ -220,8 +358,10 @@ int get_property(const bus_args *a, const char *type, void *userptr, int size) {
     sd_bus_error error = SD_BUS_ERROR_NULL;
     sd_bus_message *m = NULL;
     GET_BUS(a);
+    stats_count("bus:calls");
 
     int r = sd_bus_get_property(tmp, a->service, a->path, a->interface, a->member, &error, &m, type);
+    schedule_dispatch(a);
     if (check_err(&r, &error, a->caller)) {
         goto finish;
     }
@@ -256,13 +396,10 @@ static void free_bus_structs(sd_bus_error *err, sd_bus_message *m, sd_bus_messag
 static int check_err(int *r, sd_bus_error *err, const char *caller) {
     if (*r < 0) {
         DEBUG("%s(): %s\n", caller, err && err->message ? err->message : strerror(-*r));
+        stats_count("bus:errors");
     }
     
     /* -1 on error, 0 ok */
     *r = -(*r < 0);
     return *r;
 }
-
-sd_bus *get_user_bus(void) {
-    return userbus;
-}
@@ -26,6 +26,18 @@ typedef struct {
     sd_bus *bus;
 } bus_args;
 
+/* Async call completion callback: r is reply_cb return value, or -1 on error */
+typedef void(*bus_done_cb)(int r, void *userdata);
+
+/*
+ * Pending async call, completed while BUS processes the bus
+ */
+typedef struct {
+    const bus_args *args;
+    sd_bus_slot *slot;
+    bus_done_cb done_cb;
+} bus_pending;
+
 #define BUS_ARG(name, ...)      bus_args name = { __VA_ARGS__, __func__ };
 
 /* Define a bus_args local variable to actually parse message response */
@@ -38,7 +50,8 @@ typedef struct {
 
 
 int call(const bus_args *a, const char *signature, ...);
+int call_async(const bus_args *a, bus_pending *p, bus_done_cb done_cb, const char *signature, ...);
+void cancel_call(bus_pending *p);
 int add_match(const bus_args *a, sd_bus_slot **slot, sd_bus_message_handler_t cb);
 int set_property(const bus_args *a, const char type, const void *value);
 int get_property(const bus_args *a, const char *type, void *userptr, int size);
-sd_bus *get_user_bus(void);
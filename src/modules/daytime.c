@@ -1,14 +1,22 @@
+#include <sys/timerfd.h>
 #include "my_math.h"
+#include "ephemeris.h"
 #include "timer.h"
 
 static void receive_waiting_loc(const msg_t *const msg, UNUSED const void* userdata);
 static void check_daytime(void);
 static void get_next_events(const time_t *now, const float lat, const float lon, bool tomorrow);
+static int get_event(const float lat, const float lon, enum day_events event, time_t *t, bool tomorrow);
 static void check_next_event(const time_t *now);
 static void check_state(const time_t *now);
 static void reset_daytime(void);
+static void set_next_alarm(time_t when);
+static void update_day_fd(void);
+static void ack_suspend(const msg_t *const msg);
 
-static int gamma_fd;
+static int day_fd = -1;
+static bool day_fd_registered;
+static bool force_temp = true;      // whether next check_daytime() must publish TEMP_REQ even if neither daytime nor in_event changed
 
 DECLARE_MSG(time_msg, DAYTIME_UPD);
 DECLARE_MSG(in_ev_msg, IN_EVENT_UPD);
@@ -16,6 +24,7 @@ DECLARE_MSG(sunrise_msg, SUNRISE_UPD);
 DECLARE_MSG(sunset_msg, SUNSET_UPD);
 DECLARE_MSG(next_ev_msg, NEXT_DAYEVT_UPD);
 DECLARE_MSG(temp_req, TEMP_REQ);
+DECLARE_MSG(suspend_ack, SUSPEND_ACK_REQ);
 
 MODULE("DAYTIME");
 
@@ -23,6 +32,8 @@ static void init(void) {
     M_SUB(LOC_UPD);
     M_SUB(SUNRISE_REQ);
     M_SUB(SUNSET_REQ);
+    M_SUB(DEEP_IDLE_UPD);
+    M_SUB(SUSPEND_UPD);
     m_become(waiting_loc);
 }
 
@@ -35,7 +46,9 @@ static bool evaluate(void) {
 }
 
 static void destroy(void) {
-    
+    if (day_fd >= 0) {
+        close(day_fd);
+    }
 }
 
 static void receive_waiting_loc(const msg_t *const msg, UNUSED const void* userdata) {
@@ -54,12 +67,20 @@ static void receive_waiting_loc(const msg_t *const msg, UNUSED const void* userd
             M_PUB(&time_msg);
             state.day_time = DAY;
         } else {
-            gamma_fd = start_timer(CLOCK_BOOTTIME, 0, 1);
-            m_register_fd(gamma_fd, true, NULL);
+            /* 
+             * Use an absolute CLOCK_REALTIME timer, 
+             * cancelled when the clock jumps (eg: NTP adjustments or timezone changes).
+             */
+            day_fd = start_timer(CLOCK_REALTIME, 0, 1);
+            update_day_fd();
             m_unbecome();
         }
         break;
     }
+    case SUSPEND_UPD:
+        /* No daytime computed yet */
+        ack_suspend(msg);
+        break;
     default:
         break;
     }
@@ -68,9 +89,32 @@ static void receive_waiting_loc(const msg_t *const msg, UNUSED const void* userd
 static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     switch (MSG_TYPE()) {
         case FD_UPD:
-            read_timer(msg->fd_msg->fd);
+            if (read_timer(msg->fd_msg->fd) == -1) {
+                DEBUG("Clock changed. Recomputing sunrise and sunset times.\n");
+                state.day_events[SUNSET] = 0; // to force get_next_events to recheck sunrise and sunset for today
+                force_temp = true;
+            }
             check_daytime();
             break;
+        case DEEP_IDLE_UPD:
+            update_day_fd();
+            break;
+        case SUSPEND_UPD: {
+            suspend_upd *up = (suspend_upd *)MSG_DATA();
+            if (!up->new) {
+                /* 
+                 * Single refresh on resume: recompute daytime straight away
+                 * (and let GAMMA follow through TEMP_REQ), 
+                 * as anything may have changed while sleeping.
+                 * SLEEP then requests a capture, against up to date daytime.
+                 */
+                force_temp = true;
+                check_daytime();
+            }
+            update_day_fd();
+            ack_suspend(msg);
+            break;
+        }
         case LOC_UPD:
             reset_daytime();
             DEBUG("New position received. Updating sunrise and sunset times.\n");
@@ -139,20 +183,55 @@ static void check_daytime(void) {
     /**                                 **/
     
     /*
-     * Forcefully set correct gamma every time
-     * to avoid any possible sync issue
-     * between time of day and gamma (eg after long suspend).
+     * Set correct gamma on first check, when daytime or in_event changed,
+     * or after a clock change.
      */
-    if (!conf.gamma_conf.disabled) {
+    if (!conf.gamma_conf.disabled && 
+        (force_temp || old_state != state.day_time || old_in_event != state.in_event)) {
+        
         temp_req.temp.daytime = -1;
         temp_req.temp.smooth = -1;
         temp_req.temp.new = conf.gamma_conf.temp[state.day_time];
         M_PUB(&temp_req);
+        force_temp = false;
     }
-        
-    const time_t next = state.day_events[state.next_event] + state.event_time_range;
-    INFO("Next alarm due to: %s", ctime(&next));
-    set_timeout(next - t, 0, gamma_fd, 0);
+    
+    set_next_alarm(state.day_events[state.next_event] + state.event_time_range);
+}
+
+/*
+ * Stop listening on our fd while in deep-idle or suspended; 
+ * if an alarm (or a clock change) happens meanwhile, it will be noticed on exit.
+ */
+static void update_day_fd(void) {
+    const bool listen = !state.deep_idle && !state.suspended;
+    if (day_fd != -1 && listen != day_fd_registered) {
+        if (listen) {
+            m_register_fd(day_fd, false, NULL);
+        } else {
+            m_deregister_fd(day_fd);
+        }
+        day_fd_registered = listen;
+    }
+}
+
+static void set_next_alarm(time_t when) {
+    INFO("Next alarm due to: %s", ctime(&when));
+    set_timeout(when, 0, day_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET);
+}
+
+/*
+ * User-set events are computed on each call; 
+ * real sunrise/sunset are looked up in yearly ephemeris table.
+ */
+static int get_event(const float lat, const float lon, enum day_events event, time_t *t, bool tomorrow) {
+    if (strlen(conf.day_conf.day_events[event]) > 0) {
+        if (event == SUNRISE) {
+            return calculate_sunrise(lat, lon, t, tomorrow);
+        }
+        return calculate_sunset(lat, lon, t, tomorrow);
+    }
+    return ephemeris_get(lat, lon, event, tomorrow, t);
 }
 
 /*
@@ -161,18 +240,16 @@ static void check_daytime(void) {
  * or of today's sunset event is finished.
  * Firstly computes day's sunrise and sunset; then calls check_next_event and check_state to
  * update next_event and state.time variables according to new state.
- * Note that "+1" is because it seems timerfd receives timer end circa 1s in advance.
- * Probably it is just some ms in advance, but rounding it to seconds returns 1s in advance.
  */
 static void get_next_events(const time_t *now, const float lat, const float lon, bool tomorrow) {
     time_t t;
     const time_t old_events[SIZE_EVENTS] = { state.day_events[SUNRISE], state.day_events[SUNSET] };
     
     /* only every new day, after today's last event (ie: sunset + event_duration) */
-    if (*now + 1 >= state.day_events[SUNSET] + conf.day_conf.event_duration) {
-        if (calculate_sunset(lat, lon, &t, tomorrow) == 0) {
+    if (*now >= state.day_events[SUNSET] + conf.day_conf.event_duration) {
+        if (get_event(lat, lon, SUNSET, &t, tomorrow) == 0) {
             /* If today's sunset was before now, compute tomorrow */
-            if (*now + 1 >= t + conf.day_conf.event_duration) {
+            if (*now >= t + conf.day_conf.event_duration) {
                 /*
                  * we're between today's sunset and tomorrow sunrise.
                  * rerun function with tomorrow.
@@ -184,14 +261,14 @@ static void get_next_events(const time_t *now, const float lat, const float lon,
             state.day_events[SUNSET] = -1;
         }
         
-        if (calculate_sunrise(lat, lon, &t, tomorrow) == 0) {
+        if (get_event(lat, lon, SUNRISE, &t, tomorrow) == 0) {
             /*
              * Force computation of today event if SUNRISE is
              * not today; eg: in local time it is at 6am, but utc time is 22,
              * so it counts as today while it is indeed tomorrow...
              */
             if (t > state.day_events[SUNSET]) {
-                calculate_sunrise(lat, lon, &t, false);
+                get_event(lat, lon, SUNRISE, &t, false);
             }
             
             state.day_events[SUNRISE] = t;
@@ -222,7 +299,8 @@ static void get_next_events(const time_t *now, const float lat, const float lon,
 
 /*
  * Updates next_event global var, according to now time_t value.
- * Note that "+1" is because it seems timerfd receives timer end circa 1s in advance.
+ * As alarms are absolute, we are woken exactly on an event: 
+ * an event time already belongs to the new daytime.
  */
 static void check_next_event(const time_t *now) {
     /*
@@ -230,17 +308,16 @@ static void check_next_event(const time_t *now) {
      * We're after state.events[SUNSET] (when clight is started between SUNSET)
      * We're before state.events[SUNRISE] (when clight is started before today's SUNRISE)
      */
-    if (*now + 1 > state.day_events[SUNSET] || *now + 1 < state.day_events[SUNRISE]) {
+    if (*now >= state.day_events[SUNSET] || *now < state.day_events[SUNRISE]) {
         state.day_time = NIGHT;
     } else {
         state.day_time = DAY;
     }
-    state.next_event = (*now + 1 < (state.day_events[SUNRISE] + conf.day_conf.event_duration)) ? SUNRISE : SUNSET;    
+    state.next_event = (*now < (state.day_events[SUNRISE] + conf.day_conf.event_duration)) ? SUNRISE : SUNSET;
 }
 
 /*
  * Updates state.time global var, according to now time_t value.
- * Note that "+1" is because it seems timerfd receives timer end circa 1s in advance.
  * If we're inside an event, checks which side of the events we're in
  * (to understand which conf.temp is correct for this state).
  * Then sets event_time_range accordingly; ie: 30mins before event, if we're not inside an event;
@@ -248,8 +325,8 @@ static void check_next_event(const time_t *now) {
  * 30mins after event to remove EVENT state.
  */
 static void check_state(const time_t *now) {
-    if (labs(state.day_events[state.next_event] - (*now + 1)) <= conf.day_conf.event_duration) {
-        if (state.day_events[state.next_event] > *now + 1) {
+    if (labs(state.day_events[state.next_event] - *now) <= conf.day_conf.event_duration) {
+        if (state.day_events[state.next_event] > *now) {
             state.event_time_range = 0; // next timer is on next_event
         } else {
             state.event_time_range = conf.day_conf.event_duration; // next timer is when leaving event
@@ -265,5 +342,11 @@ static void check_state(const time_t *now) {
 static void reset_daytime(void) {
     /* Updated sunrise/sunset times for new location */
     state.day_events[SUNSET] = 0; // to force get_next_events to recheck sunrise and sunset for today
-    set_timeout(0, 1, gamma_fd, 0);
+    set_timeout(0, 1, day_fd, 0);
+}
+
+/* Let SLEEP know we are done with a SUSPEND_UPD */
+static void ack_suspend(const msg_t *const msg) {
+    suspend_ack.suspend.new = ((suspend_upd *)MSG_DATA())->new;
+    M_PUB(&suspend_ack);
 }
@@ -0,0 +1,51 @@
+#include "commons.h"
+
+static void update_deep_idle(void);
+
+DECLARE_MSG(deep_idle_msg, DEEP_IDLE_UPD);
+
+MODULE("DEEPIDLE");
+
+static void init(void) {
+    M_SUB(LID_UPD);
+    M_SUB(DISPLAY_UPD);
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return !conf.wizard;
+}
+
+static void destroy(void) {
+
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case LID_UPD:
+    case DISPLAY_UPD:
+        update_deep_idle();
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Enter deep-idle when nobody can look at the screen, ie:
+ * when lid is closed (and not docked) or display is off.
+ * Note that inhibited state is not considered: someone is actually watching the screen.
+ */
+static void update_deep_idle(void) {
+    const bool deep_idle = state.lid_state == CLOSED || (state.display_state & DISPLAY_OFF);
+    if (deep_idle != state.deep_idle) {
+        deep_idle_msg.deep_idle.old = state.deep_idle;
+        state.deep_idle = deep_idle;
+        deep_idle_msg.deep_idle.new = state.deep_idle;
+        INFO("%s deep-idle.\n", state.deep_idle ? "Entering" : "Leaving");
+        M_PUB(&deep_idle_msg);
+    }
+}
@@ -1,28 +1,61 @@
 #include "bus.h"
+#include "my_math.h"
+#include "stats.h"
 
-#define GAMMA_LONG_TRANS_TIMEOUT 10         // 10s between each step with slow transitioning
+#define ELEVATION_NIGHT     -6.0                // solar elevation (degrees) below which night temp is used (civil twilight)
+#define ELEVATION_DAY       3.0                 // solar elevation (degrees) above which day temp is used
+#define SCHED_SCAN_STEP     300                 // resolution (s) of the scan for next long transition step
+#define SCHED_HORIZON       (24 * 60 * 60)      // how far (s) to look for next long transition step
+#define COALESCE_WINDOW_MS  250                 // requests received within this window are coalesced in a single Set
 
 static void receive_waiting_daytime(const msg_t *const msg, UNUSED const void* userdata);
 static int parse_bus_reply(sd_bus_message *reply, const char *member, void *userdata);
-static void set_temp(int temp, const time_t *now, int smooth, int step, int timeout);
+static void set_temp(int temp, int smooth, int step, int timeout);
+static void request_temp(int temp, int smooth, int step, int timeout);
+static void flush_request(void);
 static void ambient_callback(void);
-static void on_next_dayevt(evt_upd *up);
-static void on_daytime_req(temp_upd *up);
+static void on_daytime_req(void);
 static void interface_callback(temp_upd *req);
+static void cancel_transition(void);
+static uint64_t now_ms(void);
+static bool is_transitioning(void);
+static void on_display_update(void);
+static void retarget(void);
+static inline double to_mired(int temp);
+static double day_fraction(time_t t);
+static int target_temp(time_t t);
+static bool step_needed(time_t t, int applied);
+static time_t next_step(time_t now, int applied);
+static void schedule_temp(void);
+static void ack_suspend(const msg_t *const msg);
 
-static bool long_transitioning;
+static uint64_t transition_end;             // CLOCK_MONOTONIC ms at which last smooth transition is expected to end; 0 if none
+static int gamma_timer = -1;
+static int coalesce_timer = -1;
+static struct {
+    bool valid;
+    int temp;
+    int smooth;
+    int step;
+    int timeout;
+} pending;                                  // last temp request received within current coalescing window
 static const self_t *daytime_ref;
 
 DECLARE_MSG(temp_msg, TEMP_UPD);
+DECLARE_MSG(suspend_ack, SUSPEND_ACK_REQ);
 
 MODULE("GAMMA");
 
 static void init(void) {
     m_ref("DAYTIME", &daytime_ref);
+    gamma_timer = timer_new(self(), "gamma", 0, 0);
+    coalesce_timer = timer_new(self(), "gamma-coalesce", 0, 0);
     M_SUB(BL_UPD);
     M_SUB(TEMP_REQ);
     M_SUB(DAYTIME_UPD);
-    M_SUB(NEXT_DAYEVT_UPD);
+    M_SUB(LOC_UPD);
+    M_SUB(SUSPEND_UPD);
+    M_SUB(DISPLAY_UPD);
     m_become(waiting_daytime);
 }
 
@@ -36,7 +69,8 @@ static bool evaluate(void) {
 }
 
 static void destroy(void) {
-
+    timer_free(gamma_timer);
+    timer_free(coalesce_timer);
 }
 
 static void receive_waiting_daytime(const msg_t *const msg, UNUSED const void* userdata) {
@@ -55,6 +89,10 @@ static void receive_waiting_daytime(const msg_t *const msg, UNUSED const void* u
         }
         break;
     }
+    case SUSPEND_UPD:
+        /* No temp set yet */
+        ack_suspend(msg);
+        break;
     default:
         break;
     }
@@ -62,6 +100,15 @@ static void receive_waiting_daytime(const msg_t *const msg, UNUSED const void* u
 
 static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     switch (MSG_TYPE()) {
+    case TIMER_UPD: {
+        timer_upd *up = (timer_upd *)MSG_DATA();
+        if (up->id == coalesce_timer) {
+            flush_request();
+        } else {
+            schedule_temp();
+        }
+        break;
+    }
     case BL_UPD:
         ambient_callback();
         break;
@@ -69,18 +116,30 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
         temp_upd *up = (temp_upd *)MSG_DATA();
         if (VALIDATE_REQ(up)) {
             if (msg->ps_msg->sender == daytime_ref) {
-                on_daytime_req(up);
+                on_daytime_req();
             } else {
                 interface_callback(up);
             }
         }
         break;
     }
-    case NEXT_DAYEVT_UPD: {
-        evt_upd *up = (evt_upd *)MSG_DATA();
-        on_next_dayevt(up);
+    case LOC_UPD:
+        /* Solar elevation changed */
+        if (conf.gamma_conf.long_transition && !conf.gamma_conf.ambient_gamma) {
+            schedule_temp();
+        }
+        break;
+    case SUSPEND_UPD: {
+        suspend_upd *up = (suspend_upd *)MSG_DATA();
+        if (up->new) {
+            cancel_transition();
+        }
+        ack_suspend(msg);
         break;
     }
+    case DISPLAY_UPD:
+        on_display_update();
+        break;
     default:
         break;
     }
@@ -90,33 +149,26 @@ static int parse_bus_reply(sd_bus_message *reply, const char *member, void *user
     return sd_bus_message_read(reply, "b", userdata);
 }
 
-static void set_temp(int temp, const time_t *now, int smooth, int step, int timeout) {
+/*
+ * Apply temp straight away, unless it is already the applied one,
+ * ie: state.current_temp, as GAMMA manages a single X display.
+ */
+static void set_temp(int temp, int smooth, int step, int timeout) {
+    if (state.display_state & DISPLAY_OFF) {
+        /* Nobody can see it; correct temp will be applied once display is back on */
+        DEBUG("Gamma temp %d not set as display is off.\n", temp);
+        return;
+    }
+    if (temp == state.current_temp) {
+        DEBUG("Gamma temp %d already set.\n", temp);
+        stats_count("gamma:suppressed");
+        return;
+    }
+    
     int ok;
     SYSBUS_ARG_REPLY(args, parse_bus_reply, &ok, CLIGHTD_SERVICE, "/org/clightd/clightd/Gamma", "org.clightd.clightd.Gamma", "Set");
     
-    /* Compute long transition steps and timeouts (if outside of event, fallback to normal transition) */
-    if (conf.gamma_conf.long_transition && now && state.in_event) {
-        smooth = 1;
-        if (state.event_time_range == 0) {
-            /* Remaining time in first half + second half of transition */
-            timeout = (state.day_events[state.next_event] - *now) + conf.day_conf.event_duration;
-            temp = conf.gamma_conf.temp[!state.day_time]; // use correct temp, ie the one for next event
-        } else {
-            /* Remaining time in second half of transition */
-            timeout = conf.day_conf.event_duration - (*now - state.day_events[state.next_event]);
-        }
-        /* Temperature difference */
-        step = abs(conf.gamma_conf.temp[DAY] - conf.gamma_conf.temp[NIGHT]);
-        /* Compute each step size with a gamma_trans_timeout of 10s */
-        step /= (((double)timeout) / GAMMA_LONG_TRANS_TIMEOUT);
-        /* force gamma_trans_timeout to 10s (in ms) */
-        timeout = GAMMA_LONG_TRANS_TIMEOUT * 1000;
-        
-        long_transitioning = true;
-    } else {
-        long_transitioning = false;
-    }
-    
+    stats_count("gamma:issued");
     int r = call(&args, "ssi(buu)", state.display, state.xauthority, temp, smooth, step, timeout);
     if (!r && ok) {
         temp_msg.temp.old = state.current_temp;
@@ -127,16 +179,24 @@ static void set_temp(int temp, const time_t *now, int smooth, int step, int time
         temp_msg.temp.timeout = timeout;
         temp_msg.temp.daytime = state.day_time;
         M_PUB(&temp_msg);
-        if (!long_transitioning && conf.gamma_conf.no_smooth) {
+        if (smooth) {
+            /* Clightd moves by "step" K every "timeout" ms */
+            const int steps = step > 0 ? (abs(temp_msg.temp.new - temp_msg.temp.old) + step - 1) / step : 1;
+            transition_end = now_ms() + (uint64_t)steps * timeout;
+        } else {
+            transition_end = 0;
+        }
+        if (!smooth) {
             INFO("%d gamma temp set.\n", temp);
         } else {
-            INFO("%s transition to %d gamma temp started.\n", long_transitioning ? "Long" : "Normal", temp);
+            INFO("Transition to %d gamma temp started.\n", temp);
         }
     }
 }
 
 static void ambient_callback(void) {
-    if (conf.gamma_conf.ambient_gamma) {
+    /* While dimmed, backlight changes are not due to ambient brightness */
+    if (conf.gamma_conf.ambient_gamma && state.display_state == DISPLAY_ON) {
         /* 
          * Note that conf.temp is not constant (it can be changed through bus api),
          * thus we have to always compute these ones.
@@ -145,52 +205,220 @@ static void ambient_callback(void) {
         const int min_temp = conf.gamma_conf.temp[NIGHT] < conf.gamma_conf.temp[DAY] ? 
                             conf.gamma_conf.temp[NIGHT] : conf.gamma_conf.temp[DAY]; 
         
-        const int ambient_temp = (diff * state.current_bl_pct) + min_temp;
-        set_temp(ambient_temp, NULL, !conf.gamma_conf.no_smooth, 
-                 conf.gamma_conf.trans_step, conf.gamma_conf.trans_timeout); // force refresh (passing NULL time_t*)
+        const int ambient_temp = lround(diff * state.current_bl_pct) + min_temp;
+        request_temp(ambient_temp, !conf.gamma_conf.no_smooth, 
+                     conf.gamma_conf.trans_step, conf.gamma_conf.trans_timeout);
     }
 }
 
-static void on_next_dayevt(evt_upd *up) {
-    static time_t last_t;                          // last time_t check_gamma() was called
-    
-    const time_t t = time(NULL);
-    struct tm tm_now, tm_old;
-    localtime_r(&t, &tm_now);
-    localtime_r(&last_t, &tm_old);
-    
-    /* 
-     * Properly reset long_transitioning when we change target event or we change current day.
-     * This is needed when:
-     * 1) we change target event (ie: when event_time_range == -conf.event_duration)
-     * 2) we are suspended and:
-     *      A) resumed with a different next_event
-     *      B) resumed with same next_event but in a different day/year (well this is kinda overkill)
-     */
-    if (long_transitioning &&
-        (tm_now.tm_yday != tm_old.tm_yday || 
-        tm_now.tm_year != tm_old.tm_year)) {
-        
-        INFO("Long transition ended.\n");
-        long_transitioning = false;
+static void on_daytime_req(void) {
+    if (!conf.gamma_conf.ambient_gamma) {
+        if (conf.gamma_conf.long_transition) {
+            schedule_temp();
+        } else {
+            request_temp(conf.gamma_conf.temp[state.day_time], !conf.gamma_conf.no_smooth, 
+                         conf.gamma_conf.trans_step, conf.gamma_conf.trans_timeout);
+        }
+    }
+}
+
+static void interface_callback(temp_upd *req) {
+    if (req->new != conf.gamma_conf.temp[req->daytime]) {
+        conf.gamma_conf.temp[req->daytime] = req->new;
+        if (!conf.gamma_conf.ambient_gamma) {
+            if (conf.gamma_conf.long_transition) {
+                schedule_temp();
+            } else if (req->daytime == state.day_time) {
+                request_temp(req->new, req->smooth, req->step, req->timeout);
+            }
+        }
+    }
+}
+
+/*
+ * Coalesce bursts of requests (eg: backlight transitions with ambient_gamma)
+ * received within COALESCE_WINDOW_MS: only last one gets applied, once window ends.
+ */
+static void request_temp(int temp, int smooth, int step, int timeout) {
+    if (!pending.valid) {
+        timer_set(coalesce_timer, 0, COALESCE_WINDOW_MS * 1000 * 1000);
+    } else {
+        stats_count("gamma:coalesced");
+    }
+    pending.valid = true;
+    pending.temp = temp;
+    pending.smooth = smooth;
+    pending.step = step;
+    pending.timeout = timeout;
+}
+
+static void flush_request(void) {
+    if (pending.valid) {
+        pending.valid = false;
+        set_temp(pending.temp, pending.smooth, pending.step, pending.timeout);
+    }
+}
+
+/*
+ * Before sleeping, jump straight to target temp:
+ * a transition would otherwise be resumed, outdated, after resume.
+ * DAYTIME will ask for a fresh temp on resume.
+ */
+static void cancel_transition(void) {
+    flush_request();
+    if (is_transitioning()) {
+        int ok;
+        SYSBUS_ARG_REPLY(args, parse_bus_reply, &ok, CLIGHTD_SERVICE, "/org/clightd/clightd/Gamma", "org.clightd.clightd.Gamma", "Set");
+        if (!call(&args, "ssi(buu)", state.display, state.xauthority, state.current_temp, false, 0, 0) && ok) {
+            DEBUG("Gamma transition cancelled.\n");
+        }
+        transition_end = 0;
+    }
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Whether last smooth transition may still be running */
+static bool is_transitioning(void) {
+    if (transition_end != 0 && now_ms() >= transition_end) {
+        transition_end = 0;
+    }
+    return transition_end != 0;
+}
+
+/*
+ * Stop wasting gamma ramp uploads while display is off: 
+ * stop any running transition and drop requests meanwhile;
+ * once display is back on, apply correct current temp in a single (short) transition.
+ */
+static void on_display_update(void) {
+    if (state.display_state & DISPLAY_OFF) {
+        cancel_transition();
+        timer_set(gamma_timer, 0, 0);
+    } else if (state.display_state == DISPLAY_ON) {
+        retarget();
     }
-        
-    last_t = t;
 }
 
-static void on_daytime_req(temp_upd *up) {
-    const time_t t = time(NULL);
-    if (!long_transitioning && !conf.gamma_conf.ambient_gamma) {
-        set_temp(conf.gamma_conf.temp[state.day_time], &t, !conf.gamma_conf.no_smooth, 
+static void retarget(void) {
+    if (conf.gamma_conf.ambient_gamma) {
+        ambient_callback();
+    } else if (conf.gamma_conf.long_transition) {
+        schedule_temp();
+    } else {
+        set_temp(conf.gamma_conf.temp[state.day_time], !conf.gamma_conf.no_smooth, 
                  conf.gamma_conf.trans_step, conf.gamma_conf.trans_timeout);
     }
 }
 
-static void interface_callback(temp_upd *req) {
-    if (req->new != conf.gamma_conf.temp[req->daytime]) {
-        conf.gamma_conf.temp[req->daytime] = req->new;
-        if (!conf.gamma_conf.ambient_gamma && req->daytime == state.day_time) {
-            set_temp(req->new, NULL, req->smooth, req->step, req->timeout); // force refresh (passing NULL time_t*)
+static inline double to_mired(int temp) {
+    return 1000000.0 / temp;
+}
+
+/*
+ * How much of the day we are in at time t: 0 at night, 1 at day.
+ * Follow real solar elevation; if user set sunrise/sunset times,
+ * linearly go through (2 * event_duration) around each event.
+ */
+static double day_fraction(time_t t) {
+    if (!strlen(conf.day_conf.day_events[SUNRISE]) && !strlen(conf.day_conf.day_events[SUNSET])) {
+        const double elevation = solar_elevation(state.current_loc.lat, state.current_loc.lon, t);
+        return clamp((elevation - ELEVATION_NIGHT) / (ELEVATION_DAY - ELEVATION_NIGHT), 1, 0);
+    }
+    
+    const int duration = conf.day_conf.event_duration;
+    for (int i = 0; i < SIZE_EVENTS; i++) {
+        const time_t ev = state.day_events[i];
+        if (t > ev - duration && t < ev + duration) {
+            const double f = (double)(t - (ev - duration)) / (2 * duration);
+            return i == SUNRISE ? f : 1 - f;
+        }
+    }
+    return t >= state.day_events[SUNRISE] && t < state.day_events[SUNSET];
+}
+
+/* Interpolate between night and day temp in mired space, where equal steps are equally perceived */
+static int target_temp(time_t t) {
+    const double night = to_mired(conf.gamma_conf.temp[NIGHT]);
+    const double day = to_mired(conf.gamma_conf.temp[DAY]);
+    return lround(1000000.0 / (night + (day - night) * day_fraction(t)));
+}
+
+/* 
+ * Whether target temp at time t is perceptually different from applied one,
+ * or it reached night/day temp (so that we always end up exactly there).
+ */
+static bool step_needed(time_t t, int applied) {
+    const int target = target_temp(t);
+    if (target == applied) {
+        return false;
+    }
+    return applied == 0 ||
+           fabs(to_mired(target) - to_mired(applied)) >= conf.gamma_conf.mired_thres ||
+           target == conf.gamma_conf.temp[DAY] || target == conf.gamma_conf.temp[NIGHT];
+}
+
+/*
+ * Find the time when next step will be needed:
+ * scan SCHED_HORIZON with SCHED_SCAN_STEP resolution,
+ * then bisect down to the exact second.
+ * Returns -1 if no step is needed within SCHED_HORIZON.
+ */
+static time_t next_step(time_t now, int applied) {
+    time_t lo = now;
+    for (time_t hi = now + SCHED_SCAN_STEP; hi <= now + SCHED_HORIZON; hi += SCHED_SCAN_STEP) {
+        if (step_needed(hi, applied)) {
+            while (hi - lo > 1) {
+                const time_t mid = lo + (hi - lo) / 2;
+                if (step_needed(mid, applied)) {
+                    hi = mid;
+                } else {
+                    lo = mid;
+                }
+            }
+            return hi;
+        }
+        lo = hi;
+    }
+    return -1;
+}
+
+/*
+ * Long transition scheduler: apply current target temp if it is perceptually
+ * different from applied one, then sleep until next step will be needed.
+ */
+static void schedule_temp(void) {
+    if (state.display_state & DISPLAY_OFF) {
+        /* We will be rescheduled once display is back on */
+        return;
+    }
+    
+    const time_t now = time(NULL);
+    if (step_needed(now, state.current_temp)) {
+        set_temp(target_temp(now), !conf.gamma_conf.no_smooth, 
+                 conf.gamma_conf.trans_step, conf.gamma_conf.trans_timeout);
+    }
+    
+    if (step_needed(now, state.current_temp)) {
+        /* Failed to set temp; retry later */
+        timer_set(gamma_timer, SCHED_SCAN_STEP, 0);
+    } else {
+        const time_t next = next_step(now, state.current_temp);
+        if (next != -1) {
+            DEBUG("Next gamma step in %lds.\n", next - now);
+            timer_set(gamma_timer, next - now, 0);
+        } else {
+            timer_set(gamma_timer, SCHED_HORIZON, 0);
         }
     }
 }
+
+/* Let SLEEP know we are done with a SUSPEND_UPD */
+static void ack_suspend(const msg_t *const msg) {
+    suspend_ack.suspend.new = ((suspend_upd *)MSG_DATA())->new;
+    M_PUB(&suspend_ack);
+}
@@ -0,0 +1,294 @@
+#include "idler.h"
+#include "stats.h"
+
+#define SIMULATE_WINDOW     5           // max seconds simulated user activity is coalesced for
+
+static void receive_waiting_acstate(const msg_t *msg, UNUSED const void *userdata);
+static void receive_inhibited(const msg_t *const msg, UNUSED const void* userdata);
+static int on_new_idle(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int get_threshold(enum idle_states th);
+static int get_client_timeout(void);
+static void timeout_callback(void);
+static void update_idle_state(void);
+static void publish_idle_state(int new_state);
+static void simulate_activity(void);
+static void reset_client(void);
+static void inhibit_callback(void);
+static long now_s(void);
+
+static const enum idle_states thresholds[] = { IDLE_DIM, IDLE_DPMS };
+static sd_bus_slot *slot;
+static char client[PATH_MAX + 1];
+static int idle_timer = -1;
+static int simulate_timer = -1;                 // coalescing window for SIMULATE_REQ
+static bool simulate_window, simulate_pending;
+static long idle_start = -1;                    // CLOCK_BOOTTIME seconds since user is inactive; -1 while active
+
+DECLARE_MSG(idle_msg, IDLE_UPD);
+
+MODULE("IDLE");
+
+static void init(void) {
+    M_SUB(UPOWER_UPD);
+    M_SUB(INHIBIT_UPD);
+    M_SUB(DIMMER_TO_REQ);
+    M_SUB(DPMS_TO_REQ);
+    M_SUB(SIMULATE_REQ);
+    m_become(waiting_acstate);
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return !conf.dim_conf.disabled || !conf.dpms_conf.disabled;
+}
+
+static void destroy(void) {
+    idle_client_destroy(client);
+    if (slot) {
+        slot = sd_bus_slot_unref(slot);
+    }
+    timer_free(idle_timer);
+    timer_free(simulate_timer);
+}
+
+static void receive_waiting_acstate(const msg_t *msg, UNUSED const void *userdata) {
+    switch (MSG_TYPE()) {
+    case UPOWER_UPD: {
+        /* A single clightd idle client, with the lowest threshold as timeout */
+        int r = idle_init(client, &slot, get_client_timeout(), on_new_idle);
+        if (r != 0) {
+            WARN("Failed to init.\n");
+            m_poisonpill(self());
+        } else {
+            /* Following thresholds must be reached even in deep-idle (eg: lid closed while dimmed) */
+            idle_timer = timer_new(self(), "idle", 0, 0);
+            timer_set_essential(idle_timer, true);
+            simulate_timer = timer_new(self(), "idle-simulate", 0, 0);
+            timer_set_essential(simulate_timer, true);
+            m_unbecome();
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case TIMER_UPD: {
+        timer_upd *up = (timer_upd *)MSG_DATA();
+        if (up->id == simulate_timer) {
+            /* Window closed: issue a single reset for any coalesced request */
+            simulate_window = false;
+            if (simulate_pending) {
+                simulate_pending = false;
+                reset_client();
+            }
+        } else {
+            update_idle_state();
+        }
+        break;
+    }
+    case UPOWER_UPD:
+        timeout_callback();
+        break;
+    case INHIBIT_UPD:
+        inhibit_callback();
+        break;
+    case DIMMER_TO_REQ:
+    case DPMS_TO_REQ: {
+        timeout_upd *up = (timeout_upd *)MSG_DATA();
+        if (VALIDATE_REQ(up)) {
+            if (MSG_TYPE() == DIMMER_TO_REQ) {
+                conf.dim_conf.timeout[up->state] = up->new;
+            } else {
+                conf.dpms_conf.timeout[up->state] = up->new;
+            }
+            if (up->state == state.ac_state) {
+                timeout_callback();
+            }
+        }
+        break;
+    }
+    case SIMULATE_REQ: {
+        /* Validation is useless here; only for coherence */
+        if (VALIDATE_REQ((void *)msg->ps_msg->message)) {
+            simulate_activity();
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static void receive_inhibited(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case UPOWER_UPD:
+        timeout_callback();
+        break;
+    case INHIBIT_UPD:
+        inhibit_callback();
+        break;
+    case DIMMER_TO_REQ:
+    case DPMS_TO_REQ: {
+        timeout_upd *up = (timeout_upd *)MSG_DATA();
+        if (VALIDATE_REQ(up)) {
+            if (MSG_TYPE() == DIMMER_TO_REQ) {
+                conf.dim_conf.timeout[up->state] = up->new;
+            } else {
+                conf.dpms_conf.timeout[up->state] = up->new;
+            }
+            if (up->state == state.ac_state) {
+                timeout_callback();
+            }
+        }
+        break;
+    }
+    default:
+        /* SIMULATE_REQ is not handled while inhibited */
+        break;
+    }
+}
+
+/*
+ * Clightd client fires once the lowest threshold is elapsed,
+ * while logind one fires as soon as session is idle, telling since when;
+ * any other threshold is then reached through idle_timer.
+ */
+static int on_new_idle(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
+    int idle;
+    uint64_t since;
+    sd_bus_message_read(m, "b", &idle);
+    if (idle) {
+        long elapsed = get_client_timeout();
+        /* logind backend tells when user became idle */
+        if (sd_bus_message_read(m, "t", &since) > 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            const uint64_t now_us = now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+            elapsed = now_us > since ? (now_us - since) / 1000000 : 0;
+        }
+        idle_start = now_s() - elapsed;
+        update_idle_state();
+    } else {
+        idle_start = -1;
+        timer_set(idle_timer, 0, 0);
+        publish_idle_state(IDLE_ACTIVE);
+    }
+    return 0;
+}
+
+/* Timeout for given threshold in current ac state; <= 0 if disabled */
+static int get_threshold(enum idle_states th) {
+    if (th == IDLE_DIM) {
+        return conf.dim_conf.disabled ? 0 : conf.dim_conf.timeout[state.ac_state];
+    }
+    return conf.dpms_conf.disabled ? 0 : conf.dpms_conf.timeout[state.ac_state];
+}
+
+static int get_client_timeout(void) {
+    int timeout = 0;
+    for (int i = 0; i < sizeof(thresholds) / sizeof(*thresholds); i++) {
+        const int th = get_threshold(thresholds[i]);
+        if (th > 0 && (timeout == 0 || th < timeout)) {
+            timeout = th;
+        }
+    }
+    return timeout;
+}
+
+/* Reset client timeout, and re-arm idle_timer if user is already inactive */
+static void timeout_callback(void) {
+    idle_set_timeout(client, get_client_timeout());
+    if (idle_start != -1) {
+        update_idle_state();
+    }
+}
+
+/*
+ * Recompute reached thresholds from time elapsed since user became inactive
+ * (thus a raised timeout clears its bit), and arm idle_timer for the next one.
+ */
+static void update_idle_state(void) {
+    const long elapsed = now_s() - idle_start;
+    int new_state = IDLE_ACTIVE;
+    int next = 0;
+    for (int i = 0; i < sizeof(thresholds) / sizeof(*thresholds); i++) {
+        const int th = get_threshold(thresholds[i]);
+        if (th > 0) {
+            if (th <= elapsed) {
+                new_state |= thresholds[i];
+            } else if (next == 0 || th - elapsed < next) {
+                next = th - elapsed;
+            }
+        }
+    }
+    timer_set(idle_timer, next, 0);
+    publish_idle_state(new_state);
+}
+
+static void publish_idle_state(int new_state) {
+    if (new_state != state.idle_state) {
+        idle_msg.idle.old = state.idle_state;
+        state.idle_state = new_state;
+        idle_msg.idle.new = state.idle_state;
+        M_PUB(&idle_msg);
+    }
+}
+
+/*
+ * Apps (eg: video players) simulate user activity every few seconds.
+ * Reset clightd client straight away, then coalesce any further request
+ * until SIMULATE_WINDOW s (or half client timeout) are elapsed: 
+ * client gets reset once more at window end, well before its threshold.
+ * If user is already idle, eg: screen is dimmed, always reset straight away.
+ */
+static void simulate_activity(void) {
+    stats_count("idle:simulate_received");
+    if (simulate_window && idle_start == -1) {
+        simulate_pending = true;
+        stats_count("idle:simulate_coalesced");
+    } else {
+        reset_client();
+    }
+}
+
+static void reset_client(void) {
+    idle_client_reset(client, get_client_timeout());
+    const int window = fmin(SIMULATE_WINDOW, get_client_timeout() / 2);
+    simulate_window = window > 0;
+    timer_set(simulate_timer, window, 0);
+}
+
+/*
+ * If we're getting inhibited, stop idle client and drop any reached threshold,
+ * as client will only fire again after being restarted: display is restored.
+ * Else, restart it.
+ */
+static void inhibit_callback(void) {
+    if (!state.inhibited) {
+        DEBUG("Being resumed.\n");
+        idle_client_start(client, get_client_timeout());
+        m_unbecome();
+    } else {
+        DEBUG("Being paused.\n");
+        idle_client_stop(client);
+        idle_start = -1;
+        publish_idle_state(IDLE_ACTIVE);
+        timer_set(idle_timer, 0, 0);
+        timer_set(simulate_timer, 0, 0);
+        simulate_window = simulate_pending = false;
+        m_become(inhibited);
+    }
+}
+
+static long now_s(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    return now.tv_sec;
+}
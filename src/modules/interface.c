@@ -1,6 +1,10 @@
 #include <module/map.h>
+#include <sys/stat.h>
+#include "control.h"
 #include "bus.h"
-#include "config.h"
+#include "my_math.h"
+#include "stats.h"
+#include "relay.h"
 
 #define VALIDATE_PARAMS(m, signature, ...) \
     int r = sd_bus_message_read(m, signature, __VA_ARGS__); \
@@ -10,23 +14,80 @@
     }
 
 #define CLIGHT_COOKIE -1
+#define PROPS_DEFER_MS 5 // changed properties are accumulated for this many ms, then emitted in a single signal
+#define MAX_QUEUED_SIGNALS 64 // subscribers signals are dropped while more than this many messages are waiting to be written
+#define MAX_SNAPSHOT_OBJS 16 // max number of objects whose properties are part of Snapshot
 #define CLIGHT_INH_KEY "LockClight"
+#define MAX_CTL_CLIENTS 16 // max number of concurrently connected control socket clients
+#define MAX_CONF_CHANGES 64 // max number of properties set by a single Conf.SetMany call
+#define CAPTURE_WAIT_TIMEOUT 10 // s; CaptureAndWait calls fail if no capture result is received meanwhile
 
 typedef struct {
     int cookie;
     int refs;
-    const char *app;
-    const char *reason;
+    const char *key;            // lock owner, ie: bus sender (interned)
+    const char *app;            // interned
+    const char *reason;         // interned
 } lock_t;
 
+/* Refcounted string shared by locks, eg: many locks held by same app for same reason */
+typedef struct {
+    int refs;
+    char str[];
+} interned_t;
+
+typedef struct {
+    bool active;
+    double min_delta;           // minimum change since last sent value
+    unsigned int min_interval;  // minimum ms between two signals
+    double last_value;
+    uint64_t last_sent;         // CLOCK_MONOTONIC ms of last sent signal; 0 if none
+} subscription_t;
+
+/* Subscriptions of a single bus client, indexed by topic */
+typedef struct {
+    subscription_t subs[MSGS_SIZE];
+} subscriber_t;
+
+/* Object whose properties are part of Snapshot */
+typedef struct {
+    const char *path;
+    const char *interface;
+    const sd_bus_vtable *vtable;
+    void *userdata;
+} snapshot_obj_t;
+
+/* A validated Conf property change, staged by Conf.SetMany */
+typedef struct {
+    const sd_bus_vtable *prop;
+    void *data;                 // conf field
+    bool publish;               // whether change is applied through its module request, or written straight to conf
+    union {
+        int i;
+        double d;
+        const char *s;
+        loc_t loc;
+        struct {
+            const double *points;
+            int num;
+        } curve;
+    } val;
+} conf_change_t;
+
 /** org.freedesktop.ScreenSaver spec implementation **/
 static void lock_dtor(void *data);
+static const char *intern(const char *str);
+static void unintern(const char *str);
+static int new_cookie(void);
+static lock_t *get_lock_by_cookie(int cookie);
 static int start_inhibit_monitor(void);
 static void inhibit_parse_msg(sd_bus_message *m);
 static int on_bus_name_changed(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error);
 static int create_inhibit(int *cookie, const char *key, const char *app_name, const char *reason);
 static int drop_inhibit(int *cookie, const char *key, bool force);
+static int clight_inhibit(bool inhibit);
 static int method_clight_inhibit(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int change_backlight(double change_pct);
 static int method_clight_changebl(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 static int method_inhibit(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 static int method_uninhibit(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
@@ -34,11 +95,32 @@ static int method_simulate_activity(sd_bus_message *m, void *userdata, sd_bus_er
 static int method_get_inhibit(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 
 /** Clight bus api **/
+static void receive_updates(void);
+static void process_bus(void);
+static void queue_property(const char *name);
+static void flush_properties(void);
+static const sd_bus_vtable *get_state_property(const char *name);
+static const sd_bus_vtable *get_topic_property(const char *topic, int *type);
+static double get_property_value(const sd_bus_vtable *prop);
+static void notify_subscribers(const enum mod_msg_types type);
+static int send_changed(const char *dest, const char *topic, const sd_bus_vtable *prop);
+static void drop_subscriber(const char *name);
+static int on_subscriber_changed(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error);
+static int method_subscribe(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_unsubscribe(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int add_object_vtable(const char *path, const char *interface, const sd_bus_vtable *vtable, void *userdata);
+static void invalidate_snapshot(void);
+static int build_snapshot(void);
+static int method_snapshot(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 static int get_version(sd_bus *b, const char *path, const char *interface, const char *property,
                        sd_bus_message *reply, void *userdata, sd_bus_error *error);
 static int method_capture(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_capture_and_wait(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static void reply_capture_waiters(const captured_upd *up);
 static int method_load(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 static int method_unload(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int forward_call(sd_bus_message *m, enum relay_calls call, const char *arg, sd_bus_error *ret_error);
+static void reply_relay_call(const relay_frame_t *f);
 static int get_curve(sd_bus *bus, const char *path, const char *interface, const char *property,
                      sd_bus_message *reply, void *userdata, sd_bus_error *error);
 static int set_curve(sd_bus *bus, const char *path, const char *interface, const char *property,
@@ -57,7 +139,37 @@ static int set_event(sd_bus *bus, const char *path, const char *interface, const
                         sd_bus_message *value, void *userdata, sd_bus_error *error);
 static int set_screen_contrib(sd_bus *bus, const char *path, const char *interface, const char *property,
                               sd_bus_message *value, void *userdata, sd_bus_error *error);
+static int set_conf(sd_bus *bus, const char *path, const char *interface, const char *property,
+                    sd_bus_message *value, void *userdata, sd_bus_error *error);
+static int write_conf(void *data, const char type, const void *val);
 static int method_store_conf(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static message_t *timeout_req(const void *data);
+static message_t *curve_req(const void *data);
+static int parse_conf_change(sd_bus_message *m, const char *key, conf_change_t *c, sd_bus_error *ret_error);
+static const void *conf_change_group(const conf_change_t *c);
+static int validate_conf_change(const conf_change_t *c);
+static bool conf_change_is_current(const conf_change_t *c);
+static int apply_conf_change(const conf_change_t *c);
+static int method_set_many(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+
+/** Control socket api **/
+static int start_control_socket(void);
+static void control_accept(int fd);
+static void control_serve(int fd);
+static int control_handle(const clight_ctl_req_t *req);
+
+/** Stats bus api **/
+static void append_wakeup(const char *source, uint64_t count, double rate, void *userdata);
+static int get_wakeups(sd_bus *bus, const char *path, const char *interface, const char *property,
+                       sd_bus_message *reply, void *userdata, sd_bus_error *error);
+static int get_uptime(sd_bus *bus, const char *path, const char *interface, const char *property,
+                      sd_bus_message *reply, void *userdata, sd_bus_error *error);
+static int get_wakeups_window(sd_bus *bus, const char *path, const char *interface, const char *property,
+                              sd_bus_message *reply, void *userdata, sd_bus_error *error);
+static void append_counter(const char *counter, uint64_t count, void *userdata);
+static int get_counters(sd_bus *bus, const char *path, const char *interface, const char *property,
+                        sd_bus_message *reply, void *userdata, sd_bus_error *error);
+static int method_reset_stats(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 
 static const char object_path[] = "/org/clight/clight";
 static const char bus_interface[] = "org.clight.clight";
@@ -79,6 +191,9 @@ static const sd_bus_vtable clight_vtable[] = {
     SD_BUS_PROPERTY("Inhibited", "b", NULL, offsetof(state_t, inhibited), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
     SD_BUS_PROPERTY("PmInhibited", "b", NULL, offsetof(state_t, pm_inhibited), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
     SD_BUS_PROPERTY("SensorAvail", "b", NULL, offsetof(state_t, sens_avail), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("DeepIdle", "b", NULL, offsetof(state_t, deep_idle), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("Suspended", "b", NULL, offsetof(state_t, suspended), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("IdleState", "i", NULL, offsetof(state_t, idle_state), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
     SD_BUS_PROPERTY("BlPct", "d", NULL, offsetof(state_t, current_bl_pct), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
     SD_BUS_PROPERTY("KbdPct", "d", NULL, offsetof(state_t, current_kbd_pct), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
     SD_BUS_PROPERTY("AmbientBr", "d", NULL, offsetof(state_t, ambient_br), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
@@ -86,30 +201,37 @@ static const sd_bus_vtable clight_vtable[] = {
     SD_BUS_PROPERTY("Location", "(dd)", get_location, offsetof(state_t, current_loc), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
     SD_BUS_PROPERTY("ScreenComp", "d", NULL, offsetof(state_t, screen_comp), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
     SD_BUS_METHOD("Capture", "bb", NULL, method_capture, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("CaptureAndWait", NULL, "ddd", method_capture_and_wait, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("Inhibit", "b", NULL, method_clight_inhibit, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("IncBl", "d", NULL, method_clight_changebl, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("DecBl", "d", NULL, method_clight_changebl, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("Load", "s", NULL, method_load, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("Unload", "s", NULL, method_unload, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("Subscribe", "sdu", NULL, method_subscribe, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("Unsubscribe", "s", NULL, method_unsubscribe, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_SIGNAL("Changed", "sv", 0),
+    SD_BUS_METHOD("Snapshot", NULL, "ta{sa{sv}}", method_snapshot, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("SnapshotIfChanged", "t", "ta{sa{sv}}", method_snapshot, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_VTABLE_END
 };
 
 static const sd_bus_vtable conf_vtable[] = {
     SD_BUS_VTABLE_START(0),
-    SD_BUS_WRITABLE_PROPERTY("Verbose", "b", NULL, NULL, offsetof(conf_t, verbose), 0),
+    SD_BUS_WRITABLE_PROPERTY("Verbose", "b", NULL, set_conf, offsetof(conf_t, verbose), 0),
     SD_BUS_METHOD("Store", NULL, NULL, method_store_conf, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("SetMany", "a{sv}", NULL, method_set_many, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_VTABLE_END
 };
 
 static const sd_bus_vtable conf_bl_vtable[] = {
     SD_BUS_VTABLE_START(0),
     SD_BUS_WRITABLE_PROPERTY("NoAutoCalib", "b", NULL, set_auto_calib, offsetof(bl_conf_t, no_auto_calib), 0),
-    SD_BUS_WRITABLE_PROPERTY("InhibitOnLidClosed", "b", NULL, NULL, offsetof(bl_conf_t, pause_on_lid_closed), 0),
-    SD_BUS_WRITABLE_PROPERTY("BacklightSyspath", "s", NULL, NULL, offsetof(bl_conf_t, screen_path), 0),
-    SD_BUS_WRITABLE_PROPERTY("NoSmooth", "b", NULL, NULL, offsetof(bl_conf_t, no_smooth), 0),
-    SD_BUS_WRITABLE_PROPERTY("TransStep", "d", NULL, NULL, offsetof(bl_conf_t, trans_step), 0),
-    SD_BUS_WRITABLE_PROPERTY("TransDuration", "i", NULL, NULL, offsetof(bl_conf_t, trans_timeout), 0),
-    SD_BUS_WRITABLE_PROPERTY("ShutterThreshold", "d", NULL, NULL, offsetof(bl_conf_t, shutter_threshold), 0),
+    SD_BUS_WRITABLE_PROPERTY("InhibitOnLidClosed", "b", NULL, set_conf, offsetof(bl_conf_t, pause_on_lid_closed), 0),
+    SD_BUS_WRITABLE_PROPERTY("BacklightSyspath", "s", NULL, set_conf, offsetof(bl_conf_t, screen_path), 0),
+    SD_BUS_WRITABLE_PROPERTY("NoSmooth", "b", NULL, set_conf, offsetof(bl_conf_t, no_smooth), 0),
+    SD_BUS_WRITABLE_PROPERTY("TransStep", "d", NULL, set_conf, offsetof(bl_conf_t, trans_step), 0),
+    SD_BUS_WRITABLE_PROPERTY("TransDuration", "i", NULL, set_conf, offsetof(bl_conf_t, trans_timeout), 0),
+    SD_BUS_WRITABLE_PROPERTY("ShutterThreshold", "d", NULL, set_conf, offsetof(bl_conf_t, shutter_threshold), 0),
     SD_BUS_WRITABLE_PROPERTY("AcDayTimeout", "i", NULL, set_timeouts, offsetof(bl_conf_t, timeout[ON_AC][DAY]), 0),
     SD_BUS_WRITABLE_PROPERTY("AcNightTimeout", "i", NULL, set_timeouts, offsetof(bl_conf_t, timeout[ON_AC][NIGHT]), 0),
     SD_BUS_WRITABLE_PROPERTY("AcEventTimeout", "i", NULL, set_timeouts, offsetof(bl_conf_t, timeout[ON_AC][IN_EVENT]), 0),
@@ -121,10 +243,10 @@ static const sd_bus_vtable conf_bl_vtable[] = {
 
 static const sd_bus_vtable conf_sens_vtable[] = {
     SD_BUS_VTABLE_START(0),
-    SD_BUS_WRITABLE_PROPERTY("Device", "s", NULL, NULL, offsetof(sensor_conf_t, dev_name), 0),
-    SD_BUS_WRITABLE_PROPERTY("Settings", "s", NULL, NULL, offsetof(sensor_conf_t, dev_opts), 0),
-    SD_BUS_WRITABLE_PROPERTY("AcCaptures", "i", NULL, NULL, offsetof(sensor_conf_t, num_captures[ON_AC]), 0),
-    SD_BUS_WRITABLE_PROPERTY("BattCaptures", "i", NULL, NULL, offsetof(sensor_conf_t, num_captures[ON_BATTERY]), 0),
+    SD_BUS_WRITABLE_PROPERTY("Device", "s", NULL, set_conf, offsetof(sensor_conf_t, dev_name), 0),
+    SD_BUS_WRITABLE_PROPERTY("Settings", "s", NULL, set_conf, offsetof(sensor_conf_t, dev_opts), 0),
+    SD_BUS_WRITABLE_PROPERTY("AcCaptures", "i", NULL, set_conf, offsetof(sensor_conf_t, num_captures[ON_AC]), 0),
+    SD_BUS_WRITABLE_PROPERTY("BattCaptures", "i", NULL, set_conf, offsetof(sensor_conf_t, num_captures[ON_BATTERY]), 0),
     SD_BUS_WRITABLE_PROPERTY("AcPoints", "ad", get_curve, set_curve, offsetof(sensor_conf_t, regression_points[ON_AC]), 0),
     SD_BUS_WRITABLE_PROPERTY("BattPoints", "ad", get_curve, set_curve, offsetof(sensor_conf_t, regression_points[ON_BATTERY]), 0),
     SD_BUS_VTABLE_END
@@ -132,20 +254,20 @@ static const sd_bus_vtable conf_sens_vtable[] = {
 
 static const sd_bus_vtable conf_kbd_vtable[] = {
     SD_BUS_VTABLE_START(0),
-    SD_BUS_WRITABLE_PROPERTY("Dim", "b", NULL, NULL, offsetof(kbd_conf_t, dim), 0),
-    SD_BUS_WRITABLE_PROPERTY("AmbBrThresh", "d", NULL, NULL, offsetof(kbd_conf_t, amb_br_thres), 0),
+    SD_BUS_WRITABLE_PROPERTY("Dim", "b", NULL, set_conf, offsetof(kbd_conf_t, dim), 0),
+    SD_BUS_WRITABLE_PROPERTY("AmbBrThresh", "d", NULL, set_conf, offsetof(kbd_conf_t, amb_br_thres), 0),
     SD_BUS_VTABLE_END
 };
 
 static const sd_bus_vtable conf_gamma_vtable[] = {
     SD_BUS_VTABLE_START(0),
-    SD_BUS_WRITABLE_PROPERTY("AmbientGamma", "b", NULL, NULL, offsetof(gamma_conf_t, ambient_gamma), 0),
-    SD_BUS_WRITABLE_PROPERTY("NoSmooth", "b", NULL, NULL, offsetof(gamma_conf_t, no_smooth), 0),
-    SD_BUS_WRITABLE_PROPERTY("TransStep", "i", NULL, NULL, offsetof(gamma_conf_t, trans_step), 0),
-    SD_BUS_WRITABLE_PROPERTY("TransDuration", "i", NULL, NULL, offsetof(gamma_conf_t, trans_timeout), 0),
+    SD_BUS_WRITABLE_PROPERTY("AmbientGamma", "b", NULL, set_conf, offsetof(gamma_conf_t, ambient_gamma), 0),
+    SD_BUS_WRITABLE_PROPERTY("NoSmooth", "b", NULL, set_conf, offsetof(gamma_conf_t, no_smooth), 0),
+    SD_BUS_WRITABLE_PROPERTY("TransStep", "i", NULL, set_conf, offsetof(gamma_conf_t, trans_step), 0),
+    SD_BUS_WRITABLE_PROPERTY("TransDuration", "i", NULL, set_conf, offsetof(gamma_conf_t, trans_timeout), 0),
     SD_BUS_WRITABLE_PROPERTY("DayTemp", "i", NULL, set_gamma, offsetof(gamma_conf_t, temp[DAY]), 0),
     SD_BUS_WRITABLE_PROPERTY("NightTemp", "i", NULL, set_gamma, offsetof(gamma_conf_t, temp[NIGHT]), 0),
-    SD_BUS_WRITABLE_PROPERTY("LongTransition", "b", NULL, NULL, offsetof(gamma_conf_t, long_transition), 0),
+    SD_BUS_WRITABLE_PROPERTY("LongTransition", "b", NULL, set_conf, offsetof(gamma_conf_t, long_transition), 0),
     SD_BUS_VTABLE_END
 };
 
@@ -154,19 +276,19 @@ static const sd_bus_vtable conf_daytime_vtable[] = {
     SD_BUS_WRITABLE_PROPERTY("Sunrise", "s", NULL, set_event, offsetof(daytime_conf_t, day_events[SUNRISE]), 0),
     SD_BUS_WRITABLE_PROPERTY("Sunset", "s", NULL, set_event, offsetof(daytime_conf_t, day_events[SUNSET]), 0),
     SD_BUS_WRITABLE_PROPERTY("Location", "(dd)", get_location, set_location, offsetof(daytime_conf_t, loc), 0),
-    SD_BUS_WRITABLE_PROPERTY("EventDuration", "i", NULL, NULL, offsetof(daytime_conf_t, event_duration), 0),
+    SD_BUS_WRITABLE_PROPERTY("EventDuration", "i", NULL, set_conf, offsetof(daytime_conf_t, event_duration), 0),
     SD_BUS_VTABLE_END
 };
 
 static const sd_bus_vtable conf_dimmer_vtable[] = {
     SD_BUS_VTABLE_START(0),
-    SD_BUS_WRITABLE_PROPERTY("NoSmoothEnter", "b", NULL, NULL, offsetof(dimmer_conf_t, no_smooth[ENTER]), 0),
-    SD_BUS_WRITABLE_PROPERTY("NoSmoothExit", "b", NULL, NULL, offsetof(dimmer_conf_t, no_smooth[EXIT]), 0),
-    SD_BUS_WRITABLE_PROPERTY("DimmedPct", "d", NULL, NULL, offsetof(dimmer_conf_t, dimmed_pct), 0),
-    SD_BUS_WRITABLE_PROPERTY("TransStepEnter", "d", NULL, NULL, offsetof(dimmer_conf_t, trans_step[ENTER]), 0),
-    SD_BUS_WRITABLE_PROPERTY("TransStepExit", "d", NULL, NULL, offsetof(dimmer_conf_t, trans_step[EXIT]), 0),
-    SD_BUS_WRITABLE_PROPERTY("TransDurationEnter", "i", NULL, NULL, offsetof(dimmer_conf_t, trans_timeout[ENTER]), 0),
-    SD_BUS_WRITABLE_PROPERTY("TransDurationExit", "i", NULL, NULL, offsetof(dimmer_conf_t, trans_timeout[EXIT]), 0),
+    SD_BUS_WRITABLE_PROPERTY("NoSmoothEnter", "b", NULL, set_conf, offsetof(dimmer_conf_t, no_smooth[ENTER]), 0),
+    SD_BUS_WRITABLE_PROPERTY("NoSmoothExit", "b", NULL, set_conf, offsetof(dimmer_conf_t, no_smooth[EXIT]), 0),
+    SD_BUS_WRITABLE_PROPERTY("DimmedPct", "d", NULL, set_conf, offsetof(dimmer_conf_t, dimmed_pct), 0),
+    SD_BUS_WRITABLE_PROPERTY("TransStepEnter", "d", NULL, set_conf, offsetof(dimmer_conf_t, trans_step[ENTER]), 0),
+    SD_BUS_WRITABLE_PROPERTY("TransStepExit", "d", NULL, set_conf, offsetof(dimmer_conf_t, trans_step[EXIT]), 0),
+    SD_BUS_WRITABLE_PROPERTY("TransDurationEnter", "i", NULL, set_conf, offsetof(dimmer_conf_t, trans_timeout[ENTER]), 0),
+    SD_BUS_WRITABLE_PROPERTY("TransDurationExit", "i", NULL, set_conf, offsetof(dimmer_conf_t, trans_timeout[EXIT]), 0),
     SD_BUS_WRITABLE_PROPERTY("AcTimeout", "i", NULL, set_timeouts, offsetof(dimmer_conf_t, timeout[ON_AC]), 0),
     SD_BUS_WRITABLE_PROPERTY("BattTimeout", "i", NULL, set_timeouts, offsetof(dimmer_conf_t, timeout[ON_BATTERY]), 0),
     SD_BUS_VTABLE_END
@@ -190,8 +312,18 @@ static const sd_bus_vtable conf_screen_vtable[] = {
 
 static const sd_bus_vtable conf_inh_vtable[] = {
     SD_BUS_VTABLE_START(0),
-    SD_BUS_WRITABLE_PROPERTY("InhibitDocked", "b", NULL, NULL, offsetof(inh_conf_t, inhibit_docked), 0),
-    SD_BUS_WRITABLE_PROPERTY("InhibitPM", "b", NULL, NULL, offsetof(inh_conf_t, inhibit_pm), 0),
+    SD_BUS_WRITABLE_PROPERTY("InhibitDocked", "b", NULL, set_conf, offsetof(inh_conf_t, inhibit_docked), 0),
+    SD_BUS_WRITABLE_PROPERTY("InhibitPM", "b", NULL, set_conf, offsetof(inh_conf_t, inhibit_pm), 0),
+    SD_BUS_VTABLE_END
+};
+
+static const sd_bus_vtable stats_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_PROPERTY("Wakeups", "a{s(td)}", get_wakeups, 0, 0),
+    SD_BUS_PROPERTY("Uptime", "t", get_uptime, 0, 0),
+    SD_BUS_PROPERTY("WakeupsWindow", "d", get_wakeups_window, 0, 0),
+    SD_BUS_PROPERTY("Counters", "a{st}", get_counters, 0, 0),
+    SD_BUS_METHOD("Reset", NULL, NULL, method_reset_stats, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_VTABLE_END
 };
 
@@ -212,7 +344,8 @@ DECLARE_MSG(scr_to_req, SCR_TO_REQ);
 DECLARE_MSG(inhibit_req, INHIBIT_REQ);
 DECLARE_MSG(temp_req, TEMP_REQ);
 DECLARE_MSG(capture_req, CAPTURE_REQ);
-DECLARE_MSG(curve_req, CURVE_REQ);
+DECLARE_MSG(ac_curve_req, CURVE_REQ);
+DECLARE_MSG(batt_curve_req, CURVE_REQ);
 DECLARE_MSG(calib_req, NO_AUTOCALIB_REQ);
 DECLARE_MSG(loc_req, LOCATION_REQ);
 DECLARE_MSG(contrib_req, CONTRIB_REQ);
@@ -220,137 +353,113 @@ DECLARE_MSG(sunrise_req, SUNRISE_REQ);
 DECLARE_MSG(sunset_req, SUNSET_REQ);
 DECLARE_MSG(simulate_req, SIMULATE_REQ);
 
-static map_t *lock_map;
-static sd_bus *userbus, *monbus;
-static sd_bus_message *curve_message; // this is used to keep curve points data lingering around in set_curve
+static map_t *lock_map;                 // locks, by owner (sender)
+static map_t *cookie_map;               // same locks, by cookie (not owned)
+static map_t *interned_map;             // interned_t, by string
+static sd_bus *userbus, *monbus;        // own connections: blocking calls by other modules cannot delay us
+static state_t cur_state;               // state copy, as of latest update forwarded by RELAY
+static conf_t cur_conf;                 // conf copy, as of latest update or conf notification sent by RELAY
 static sd_bus_slot *lock_slot;
-
-MODULE("INTERFACE");
+static const char *changed_props[MSGS_SIZE + 1]; // NULL-terminated list of properties pending emission
+static int num_changed_props;
+static int props_fd = -1;
+static map_t *subscribers;
+static sd_bus_slot *subscribers_slot;
+static snapshot_obj_t snapshot_objs[MAX_SNAPSHOT_OBJS];
+static int num_snapshot_objs;
+static int ctl_fd = -1;                 // control socket listening fd
+static int ctl_clients;                 // connected control socket clients
+static char ctl_path[PATH_MAX + 1];
+static sd_bus_message **capture_waiters;    // CaptureAndWait calls waiting for current capture
+static int num_capture_waiters;
+static int capture_fd = -1;             // CaptureAndWait timeout
+static sd_bus_message *snapshot_msg;    // cached Snapshot content; NULL when outdated
+static uint64_t snapshot_version = 1;
+
+MODULE_CTX("INTERFACE", IFACE_CTX);
 
 static void init(void) {
-    const char conf_path[] = "/org/clight/clight/Conf";
-    const char conf_bl_path[] = "/org/clight/clight/Conf/Backlight";
-    const char conf_sens_path[] = "/org/clight/clight/Conf/Sensor";
-    const char conf_kbd_path[] = "/org/clight/clight/Conf/Kbd";
-    const char conf_gamma_path[] = "/org/clight/clight/Conf/Gamma";
-    const char conf_daytime_path[] = "/org/clight/clight/Conf/Daytime";
-    const char conf_dim_path[] = "/org/clight/clight/Conf/Dimmer";
-    const char conf_dpms_path[] = "/org/clight/clight/Conf/Dpms";
-    const char conf_screen_path[] = "/org/clight/clight/Conf/Screen";
-    const char conf_inh_path[] = "/org/clight/clight/Conf/Inhibit"; 
-    const char sc_path_full[] = "/org/freedesktop/ScreenSaver";
-    const char sc_path[] = "/ScreenSaver";
-    const char conf_interface[] = "org.clight.clight.Conf";
-    const char conf_bl_interface[] = "org.clight.clight.Conf.Backlight";
-    const char conf_sens_interface[] = "org.clight.clight.Conf.Sensor";
-    const char conf_kbd_interface[] = "org.clight.clight.Conf.Kbd";
-    const char conf_gamma_interface[] = "org.clight.clight.Conf.Gamma";
-    const char conf_daytime_interface[] = "org.clight.clight.Conf.Daytime";
-    const char conf_dim_interface[] = "org.clight.clight.Conf.Dimmer";
-    const char conf_dpms_interface[] = "org.clight.clight.Conf.Dpms";
-    const char conf_screen_interface[] = "org.clight.clight.Conf.Screen";
-    const char conf_inh_interface[] = "org.clight.clight.Conf.Inhibit";
-    
-    userbus = get_user_bus();
+    static const char conf_path[] = "/org/clight/clight/Conf";
+    static const char conf_bl_path[] = "/org/clight/clight/Conf/Backlight";
+    static const char conf_sens_path[] = "/org/clight/clight/Conf/Sensor";
+    static const char conf_kbd_path[] = "/org/clight/clight/Conf/Kbd";
+    static const char conf_gamma_path[] = "/org/clight/clight/Conf/Gamma";
+    static const char conf_daytime_path[] = "/org/clight/clight/Conf/Daytime";
+    static const char conf_dim_path[] = "/org/clight/clight/Conf/Dimmer";
+    static const char conf_dpms_path[] = "/org/clight/clight/Conf/Dpms";
+    static const char conf_screen_path[] = "/org/clight/clight/Conf/Screen";
+    static const char conf_inh_path[] = "/org/clight/clight/Conf/Inhibit"; 
+    static const char stats_path[] = "/org/clight/clight/Stats";
+    static const char sc_path_full[] = "/org/freedesktop/ScreenSaver";
+    static const char sc_path[] = "/ScreenSaver";
+    static const char conf_interface[] = "org.clight.clight.Conf";
+    static const char conf_bl_interface[] = "org.clight.clight.Conf.Backlight";
+    static const char conf_sens_interface[] = "org.clight.clight.Conf.Sensor";
+    static const char conf_kbd_interface[] = "org.clight.clight.Conf.Kbd";
+    static const char conf_gamma_interface[] = "org.clight.clight.Conf.Gamma";
+    static const char conf_daytime_interface[] = "org.clight.clight.Conf.Daytime";
+    static const char conf_dim_interface[] = "org.clight.clight.Conf.Dimmer";
+    static const char conf_dpms_interface[] = "org.clight.clight.Conf.Dpms";
+    static const char conf_screen_interface[] = "org.clight.clight.Conf.Screen";
+    static const char conf_inh_interface[] = "org.clight.clight.Conf.Inhibit";
+    static const char stats_interface[] = "org.clight.clight.Stats";
+    
+    relay_get_state(&cur_state);
+    relay_get_conf(&cur_conf);
+    int r = sd_bus_open_user(&userbus);
+    if (r < 0) {
+        WARN("Failed to connect to user bus: %s\n", strerror(-r));
+        /* Leave IFACE_CTX loop */
+        modules_ctx_quit(IFACE_CTX, EXIT_FAILURE);
+        return;
+    }
     
     /* Main State interface */
-    int r = sd_bus_add_object_vtable(userbus,
-                                NULL,
-                                object_path,
-                                bus_interface,
-                                clight_vtable,
-                                &state);
+    r = add_object_vtable(object_path, bus_interface, clight_vtable, &cur_state);
 
     /* Generic Conf interface */
-    r += sd_bus_add_object_vtable(userbus,
-                                NULL,
-                                conf_path,
-                                conf_interface,
-                                conf_vtable,
-                                &conf);
+    r += add_object_vtable(conf_path, conf_interface, conf_vtable, &cur_conf);
+
+    /* Stats interface */
+    r += add_object_vtable(stats_path, stats_interface, stats_vtable, NULL);
 
     /* Conf/Backlight interface */
-    if (!conf.bl_conf.disabled) {
-        r += sd_bus_add_object_vtable(userbus,
-                                    NULL,
-                                    conf_bl_path,
-                                    conf_bl_interface,
-                                    conf_bl_vtable,
-                                    &conf.bl_conf);
+    if (!cur_conf.bl_conf.disabled) {
+        r += add_object_vtable(conf_bl_path, conf_bl_interface, conf_bl_vtable, &cur_conf.bl_conf);
 
         /* Conf/Sensor interface */
-        r += sd_bus_add_object_vtable(userbus,
-                                    NULL,
-                                    conf_sens_path,
-                                    conf_sens_interface,
-                                    conf_sens_vtable,
-                                    &conf.sens_conf);
+        r += add_object_vtable(conf_sens_path, conf_sens_interface, conf_sens_vtable, &cur_conf.sens_conf);
     }
     
     /* Conf/Kbd interface */
-    if (!conf.kbd_conf.disabled) {
-        r += sd_bus_add_object_vtable(userbus,
-                                    NULL,
-                                    conf_kbd_path,
-                                    conf_kbd_interface,
-                                    conf_kbd_vtable,
-                                    &conf.kbd_conf);
+    if (!cur_conf.kbd_conf.disabled) {
+        r += add_object_vtable(conf_kbd_path, conf_kbd_interface, conf_kbd_vtable, &cur_conf.kbd_conf);
     }
     
     /* Conf/Gamma interface */
-    if (!conf.gamma_conf.disabled) {
-        r += sd_bus_add_object_vtable(userbus,
-                                    NULL,
-                                    conf_gamma_path,
-                                    conf_gamma_interface,
-                                    conf_gamma_vtable,
-                                    &conf.gamma_conf);
+    if (!cur_conf.gamma_conf.disabled) {
+        r += add_object_vtable(conf_gamma_path, conf_gamma_interface, conf_gamma_vtable, &cur_conf.gamma_conf);
     }
     
-    r += sd_bus_add_object_vtable(userbus,
-                                  NULL,
-                                  conf_daytime_path,
-                                  conf_daytime_interface,
-                                  conf_daytime_vtable,
-                                  &conf.day_conf);
+    r += add_object_vtable(conf_daytime_path, conf_daytime_interface, conf_daytime_vtable, &cur_conf.day_conf);
     
     /* Conf/Dimmer interface */
-    if (!conf.dim_conf.disabled) {
-        r += sd_bus_add_object_vtable(userbus,
-                                    NULL,
-                                    conf_dim_path,
-                                    conf_dim_interface,
-                                    conf_dimmer_vtable,
-                                    &conf.dim_conf);
+    if (!cur_conf.dim_conf.disabled) {
+        r += add_object_vtable(conf_dim_path, conf_dim_interface, conf_dimmer_vtable, &cur_conf.dim_conf);
     }
     
     /* Conf/Dpms interface */
-    if (!conf.dpms_conf.disabled) {
-        r += sd_bus_add_object_vtable(userbus,
-                                    NULL,
-                                    conf_dpms_path,
-                                    conf_dpms_interface,
-                                    conf_dpms_vtable,
-                                    &conf.dpms_conf);
+    if (!cur_conf.dpms_conf.disabled) {
+        r += add_object_vtable(conf_dpms_path, conf_dpms_interface, conf_dpms_vtable, &cur_conf.dpms_conf);
     }
     
     /* Conf/Screen interface */
-    if (!conf.screen_conf.disabled) {
-        r += sd_bus_add_object_vtable(userbus,
-                                    NULL,
-                                    conf_screen_path,
-                                    conf_screen_interface,
-                                    conf_screen_vtable,
-                                    &conf.screen_conf);
+    if (!cur_conf.screen_conf.disabled) {
+        r += add_object_vtable(conf_screen_path, conf_screen_interface, conf_screen_vtable, &cur_conf.screen_conf);
     }
     
-    if (!conf.inh_conf.disabled) {
-        r += sd_bus_add_object_vtable(userbus,
-                                      NULL,
-                                      conf_inh_path,
-                                      conf_inh_interface,
-                                      conf_inh_vtable,
-                                      &conf.inh_conf);
+    if (!cur_conf.inh_conf.disabled) {
+        r += add_object_vtable(conf_inh_path, conf_inh_interface, conf_inh_vtable, &cur_conf.inh_conf);
 
             /*
             * ScreenSaver implementation:
@@ -365,14 +474,14 @@ static void init(void) {
                                         sc_path,
                                         sc_interface,
                                         sc_vtable,
-                                        &state);
+                                        &cur_state);
 
             sd_bus_add_object_vtable(userbus,
                                     NULL,
                                     sc_path_full,
                                     sc_interface,
                                     sc_vtable,
-                                    &state);
+                                    &cur_state);
     }
 
     if (r < 0) {
@@ -382,11 +491,23 @@ static void init(void) {
         if (r < 0) {
             WARN("Failed to create %s dbus interface: %s\n", bus_interface, strerror(-r));
         } else {
-            /* Subscribe to any topic expept REQUESTS */
-            m_subscribe("^[^Req].*");
+            /* Updates are forwarded by RELAY, as pubsub does not cross contexts */
+            m_register_fd(relay_get_fd(), false, &cur_state);
+            sd_bus_process(userbus, NULL);
+            m_register_fd(dup(sd_bus_get_fd(userbus)), true, userbus);
+            /* Own timerfd: TIMERS module lives on main context */
+            props_fd = start_timer(CLOCK_MONOTONIC, 0, 0);
+            m_register_fd(props_fd, true, &props_fd);
+            capture_fd = start_timer(CLOCK_MONOTONIC, 0, 0);
+            m_register_fd(capture_fd, true, &capture_fd);
+            subscribers = map_new(true, free);
+            
+            if (cur_conf.control_socket && start_control_socket() != 0) {
+                WARN("Failed to listen on %s: %s.\n", ctl_path, strerror(errno));
+            }
             
             /** org.freedesktop.ScreenSaver API **/
-            if (!conf.inh_conf.disabled) {
+            if (!cur_conf.inh_conf.disabled) {
                 if (sd_bus_request_name(userbus, sc_interface, SD_BUS_NAME_REPLACE_EXISTING) < 0) {
                     WARN("Failed to create %s dbus interface: %s\n", sc_interface, strerror(-r));
                     INFO("Fallback at monitoring requests to %s name owner.\n", sc_interface);
@@ -395,6 +516,8 @@ static void init(void) {
                     }
                 }
                 lock_map = map_new(true, lock_dtor);
+                cookie_map = map_new(true, NULL);
+                interned_map = map_new(true, free);
             }
             /**                                 **/
         }
@@ -402,7 +525,7 @@ static void init(void) {
     
     if (r < 0) {
         WARN("Failed to init.\n");
-        m_poisonpill(self());
+        modules_ctx_quit(IFACE_CTX, EXIT_FAILURE);
     }
 }
 
@@ -417,8 +540,35 @@ static bool evaluate() {
 static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     switch (MSG_TYPE()) {
     case FD_UPD: {
+        if (msg->fd_msg->userptr == &ctl_fd) {
+            control_accept(msg->fd_msg->fd);
+            break;
+        }
+        if (msg->fd_msg->userptr == &ctl_clients) {
+            control_serve(msg->fd_msg->fd);
+            break;
+        }
+        if (msg->fd_msg->userptr == &cur_state) {
+            receive_updates();
+            break;
+        }
+        if (msg->fd_msg->userptr == &props_fd) {
+            read_timer(props_fd);
+            flush_properties();
+            break;
+        }
+        if (msg->fd_msg->userptr == &capture_fd) {
+            read_timer(capture_fd);
+            reply_capture_waiters(NULL);
+            break;
+        }
+        if (msg->fd_msg->userptr == userbus) {
+            process_bus();
+            break;
+        }
         sd_bus *b = (sd_bus *)msg->fd_msg->userptr;
         int r;
+        stats_wakeup("bus:monitor");
         do {
             sd_bus_message *m = NULL;
             r = sd_bus_process(b, &m);
@@ -429,21 +579,18 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
         } while (r > 0);
         break;
     }
-    case SYSTEM_UPD:
-        break;
     default:
-        if (userbus) {
-            DEBUG("Emitting %s property\n", msg->ps_msg->topic);
-            sd_bus_emit_properties_changed(userbus, object_path, bus_interface, msg->ps_msg->topic, NULL);
-        }
         break;
     }
 }
 
 static void destroy(void) {
+    if (ctl_fd != -1) {
+        unlink(ctl_path);
+    }
     if (userbus) {
         sd_bus_release_name(userbus, bus_interface);
-        if (!conf.inh_conf.disabled) {
+        if (!cur_conf.inh_conf.disabled) {
             sd_bus_release_name(userbus, sc_interface);
         }
         userbus = sd_bus_flush_close_unref(userbus);
@@ -451,17 +598,484 @@ static void destroy(void) {
     if (monbus) {
         monbus = sd_bus_flush_close_unref(monbus);
     }
+    /* Locks release their interned strings */
     map_free(lock_map);
-    curve_message = sd_bus_message_unref(curve_message);
+    map_free(cookie_map);
+    map_free(interned_map);
+    map_free(subscribers);
+    subscribers_slot = sd_bus_slot_unref(subscribers_slot);
+    snapshot_msg = sd_bus_message_unref(snapshot_msg);
+    for (int i = 0; i < num_capture_waiters; i++) {
+        sd_bus_message_unref(capture_waiters[i]);
+    }
+    free(capture_waiters);
+}
+
+/* Drain frames sent by RELAY; leave IFACE_CTX once main context is gone */
+static void receive_updates(void) {
+    relay_frame_t f;
+    int r;
+    while ((r = relay_recv(&f)) == 1) {
+        switch (f.op) {
+        case RELAY_MSG:
+            relay_get_state(&cur_state);
+            relay_get_conf(&cur_conf);
+            invalidate_snapshot();
+            if (f.msg.type == CAPTURE_UPD) {
+                reply_capture_waiters(&f.msg.captured);
+            } else {
+                queue_property(topics[f.msg.type]);
+                notify_subscribers(f.msg.type);
+            }
+            break;
+        case RELAY_CONF:
+            relay_get_conf(&cur_conf);
+            invalidate_snapshot();
+            break;
+        case RELAY_CALL:
+            reply_relay_call(&f);
+            break;
+        default:
+            break;
+        }
+    }
+    if (r == -1) {
+        modules_ctx_quit(IFACE_CTX, EXIT_SUCCESS);
+    }
+}
+
+static void process_bus(void) {
+    int r;
+    stats_wakeup("bus:interface");
+    do {
+        r = sd_bus_process(userbus, NULL);
+    } while (r > 0);
+    if (r == -ENOTCONN || r == -ECONNRESET) {
+        WARN("Lost user bus connection.\n");
+        modules_ctx_quit(IFACE_CTX, r);
+    }
+}
+
+/*
+ * A single event (eg: a capture) publishes multiple topics in a row:
+ * accumulate changed properties and emit a single PropertiesChanged for all of them.
+ */
+static void queue_property(const char *name) {
+    /* Some forwarded topics are not properties at all, eg: "PmReq" */
+    const sd_bus_vtable *v = get_state_property(name);
+    if (!v || !(v->flags & SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE)) {
+        return;
+    }
+    
+    for (int i = 0; i < num_changed_props; i++) {
+        if (!strcmp(changed_props[i], name)) {
+            /* Already pending */
+            stats_count("interface:signals_saved");
+            return;
+        }
+    }
+    
+    changed_props[num_changed_props++] = name;
+    if (num_changed_props == 1) {
+        set_timeout(0, PROPS_DEFER_MS * 1000 * 1000, props_fd, 0);
+    } else {
+        stats_count("interface:signals_saved");
+    }
+}
+
+static void flush_properties(void) {
+    if (num_changed_props > 0) {
+        changed_props[num_changed_props] = NULL;
+        DEBUG("Emitting %d properties\n", num_changed_props);
+        int r = sd_bus_emit_properties_changed_strv(userbus, object_path, bus_interface, (char **)changed_props);
+        if (r < 0) {
+            WARN("Failed to emit PropertiesChanged: %s\n", strerror(-r));
+        }
+        num_changed_props = 0;
+    }
+}
+
+/*
+ * Subscribe(topic, min_delta, min_interval) lets each bus client receive its own 
+ * filtered "Changed" signals stream for a numeric property, 
+ * instead of being woken up by each PropertiesChanged.
+ * Signals are unicast, and skipped while value moved less than min_delta 
+ * or less than min_interval ms elapsed since the last one.
+ */
+static const sd_bus_vtable *get_state_property(const char *name) {
+    for (const sd_bus_vtable *v = clight_vtable; v->type != _SD_BUS_VTABLE_END; v++) {
+        if (v->type == _SD_BUS_VTABLE_PROPERTY && !strcmp(v->x.property.member, name)) {
+            return v;
+        }
+    }
+    return NULL;
+}
+
+static const sd_bus_vtable *get_topic_property(const char *topic, int *type) {
+    for (int i = 0; i < MSGS_SIZE; i++) {
+        if (!strcmp(topics[i], topic)) {
+            const sd_bus_vtable *v = get_state_property(topic);
+            if (v && !v->x.property.get && strlen(v->x.property.signature) == 1 && 
+                strchr("dibt", v->x.property.signature[0])) {
+                
+                *type = i;
+                return v;
+            }
+            break;
+        }
+    }
+    return NULL;
+}
+
+static double get_property_value(const sd_bus_vtable *prop) {
+    const void *ptr = (const uint8_t *)&cur_state + prop->x.property.offset;
+    switch (prop->x.property.signature[0]) {
+    case 'd':
+        return *(const double *)ptr;
+    case 't':
+        return *(const uint64_t *)ptr;
+    default:
+        return *(const int *)ptr;
+    }
+}
+
+static void notify_subscribers(const enum mod_msg_types type) {
+    if (map_length(subscribers) <= 0) {
+        return;
+    }
+    
+    int t;
+    const sd_bus_vtable *prop = get_topic_property(topics[type], &t);
+    if (!prop) {
+        return;
+    }
+    
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    const uint64_t now = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    const double value = get_property_value(prop);
+    for (map_itr_t *itr = map_itr_new(subscribers); itr; itr = map_itr_next(itr)) {
+        subscription_t *sub = &((subscriber_t *)map_itr_get_data(itr))->subs[type];
+        if (!sub->active || (sub->last_sent != 0 && 
+            (fabs(value - sub->last_value) < sub->min_delta || now - sub->last_sent < sub->min_interval))) {
+            continue;
+        }
+        
+        /* Drop stale signals while client is not keeping up with them */
+        uint64_t queued = 0;
+        sd_bus_get_n_queued_write(userbus, &queued);
+        if (queued > MAX_QUEUED_SIGNALS) {
+            stats_count("interface:signals_dropped");
+            continue;
+        }
+        
+        if (send_changed(map_itr_get_key(itr), topics[type], prop) >= 0) {
+            sub->last_value = value;
+            sub->last_sent = now;
+            stats_count("interface:signals_unicast");
+        }
+    }
+}
+
+static int send_changed(const char *dest, const char *topic, const sd_bus_vtable *prop) {
+    sd_bus_message *sig = NULL;
+    int r = sd_bus_message_new_signal(userbus, &sig, object_path, bus_interface, "Changed");
+    if (r >= 0) {
+        r = sd_bus_message_set_destination(sig, dest);
+    }
+    if (r >= 0) {
+        r = sd_bus_message_append(sig, "s", topic);
+    }
+    if (r >= 0) {
+        r = sd_bus_message_open_container(sig, SD_BUS_TYPE_VARIANT, prop->x.property.signature);
+    }
+    if (r >= 0) {
+        r = sd_bus_message_append_basic(sig, prop->x.property.signature[0], (const uint8_t *)&cur_state + prop->x.property.offset);
+    }
+    if (r >= 0) {
+        r = sd_bus_message_close_container(sig);
+    }
+    if (r >= 0) {
+        r = sd_bus_send(userbus, sig, NULL);
+    }
+    sd_bus_message_unref(sig);
+    return r;
+}
+
+static void drop_subscriber(const char *name) {
+    DEBUG("Dropping %s subscriptions.\n", name);
+    map_remove(subscribers, name);
+    if (map_length(subscribers) == 0) {
+        /* Stop listening on NameOwnerChanged signals */
+        subscribers_slot = sd_bus_slot_unref(subscribers_slot);
+    }
+}
+
+/* Release subscriptions of disconnected clients */
+static int on_subscriber_changed(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
+    const char *name = NULL, *old_owner = NULL, *new_owner = NULL;
+    if (sd_bus_message_read(m, "sss", &name, &old_owner, &new_owner) >= 0) {
+        if (map_has_key(subscribers, old_owner) && (!new_owner || !strlen(new_owner))) {
+            drop_subscriber(old_owner);
+        }
+    }
+    return 0;
+}
+
+static int method_subscribe(sd_bus_message *m, UNUSED void *userdata, sd_bus_error *ret_error) {
+    const char *topic = NULL;
+    double min_delta;
+    unsigned int min_interval;
+    
+    VALIDATE_PARAMS(m, "sdu", &topic, &min_delta, &min_interval);
+    
+    int type;
+    if (!get_topic_property(topic, &type) || min_delta < 0) {
+        sd_bus_error_set_errno(ret_error, EINVAL);
+        return -EINVAL;
+    }
+    
+    const char *sender = sd_bus_message_get_sender(m);
+    subscriber_t *s = map_get(subscribers, sender);
+    if (!s) {
+        s = calloc(1, sizeof(subscriber_t));
+        if (!s) {
+            sd_bus_error_set_errno(ret_error, ENOMEM);
+            return -ENOMEM;
+        }
+        map_put(subscribers, sender, s);
+        if (map_length(subscribers) == 1) {
+            /* Start listening on NameOwnerChanged signals */
+            USERBUS_ARG(args, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "NameOwnerChanged");
+            args.bus = userbus;
+            add_match(&args, &subscribers_slot, on_subscriber_changed);
+        }
+    }
+    
+    subscription_t *sub = &s->subs[type];
+    sub->active = true;
+    sub->min_delta = min_delta;
+    sub->min_interval = min_interval;
+    sub->last_sent = 0;
+    DEBUG("%s subscribed to %s (min delta: %.3lf, min interval: %u ms).\n", sender, topic, min_delta, min_interval);
+    return sd_bus_reply_method_return(m, NULL);
+}
+
+static int method_unsubscribe(sd_bus_message *m, UNUSED void *userdata, sd_bus_error *ret_error) {
+    const char *topic = NULL;
+    
+    VALIDATE_PARAMS(m, "s", &topic);
+    
+    int type;
+    const char *sender = sd_bus_message_get_sender(m);
+    subscriber_t *s = map_get(subscribers, sender);
+    if (!s || !get_topic_property(topic, &type) || !s->subs[type].active) {
+        sd_bus_error_set_errno(ret_error, EINVAL);
+        return -EINVAL;
+    }
+    
+    s->subs[type].active = false;
+    for (int i = 0; i < MSGS_SIZE; i++) {
+        if (s->subs[i].active) {
+            return sd_bus_reply_method_return(m, NULL);
+        }
+    }
+    drop_subscriber(sender);
+    return sd_bus_reply_method_return(m, NULL);
+}
+
+static int add_object_vtable(const char *path, const char *interface, const sd_bus_vtable *vtable, void *userdata) {
+    int r = sd_bus_add_object_vtable(userbus, NULL, path, interface, vtable, userdata);
+    /* Stats are not part of Snapshot: they change on each wakeup */
+    if (r >= 0 && vtable != stats_vtable && num_snapshot_objs < MAX_SNAPSHOT_OBJS) {
+        snapshot_objs[num_snapshot_objs++] = (snapshot_obj_t) { path, interface, vtable, userdata };
+    }
+    return r;
+}
+
+/*
+ * Snapshot returns all state and enabled modules conf properties, 
+ * as a { interface -> { property -> value } } dict, in a single call.
+ * Its content is built once after any change, then it is just copied into each reply.
+ * Changes are only seen once RELAY refreshed cur_state and cur_conf (ie: once modules applied them):
+ * a property Set does not change anything by itself.
+ * SnapshotIfChanged(version) returns an empty dict if caller already has current version.
+ */
+static void invalidate_snapshot(void) {
+    if (snapshot_msg) {
+        snapshot_msg = sd_bus_message_unref(snapshot_msg);
+        snapshot_version++;
+    }
+}
+
+static int build_snapshot(void) {
+    sd_bus_message *m = NULL;
+    int r = sd_bus_message_new_signal(userbus, &m, object_path, bus_interface, "Snapshot");
+    if (r < 0) {
+        goto end;
+    }
+    r = sd_bus_message_append(m, "t", snapshot_version);
+    if (r < 0) {
+        goto end;
+    }
+    r = sd_bus_message_open_container(m, SD_BUS_TYPE_ARRAY, "{sa{sv}}");
+    for (int i = 0; i < num_snapshot_objs && r >= 0; i++) {
+        const snapshot_obj_t *obj = &snapshot_objs[i];
+        r = sd_bus_message_open_container(m, SD_BUS_TYPE_DICT_ENTRY, "sa{sv}");
+        if (r >= 0) {
+            r = sd_bus_message_append(m, "s", obj->interface);
+        }
+        if (r >= 0) {
+            r = sd_bus_message_open_container(m, SD_BUS_TYPE_ARRAY, "{sv}");
+        }
+        for (const sd_bus_vtable *v = obj->vtable; v->type != _SD_BUS_VTABLE_END && r >= 0; v++) {
+            if (v->type != _SD_BUS_VTABLE_PROPERTY && v->type != _SD_BUS_VTABLE_WRITABLE_PROPERTY) {
+                continue;
+            }
+            void *ptr = (uint8_t *)obj->userdata + v->x.property.offset;
+            r = sd_bus_message_open_container(m, SD_BUS_TYPE_DICT_ENTRY, "sv");
+            if (r >= 0) {
+                r = sd_bus_message_append(m, "s", v->x.property.member);
+            }
+            if (r >= 0) {
+                r = sd_bus_message_open_container(m, SD_BUS_TYPE_VARIANT, v->x.property.signature);
+            }
+            if (r >= 0) {
+                if (v->x.property.get) {
+                    sd_bus_error error = SD_BUS_ERROR_NULL;
+                    r = v->x.property.get(userbus, obj->path, obj->interface, v->x.property.member, m, ptr, &error);
+                    sd_bus_error_free(&error);
+                } else {
+                    /* Strings properties without getter are char arrays */
+                    r = sd_bus_message_append_basic(m, v->x.property.signature[0], ptr);
+                }
+            }
+            if (r >= 0) {
+                r = sd_bus_message_close_container(m);
+            }
+            if (r >= 0) {
+                r = sd_bus_message_close_container(m);
+            }
+        }
+        if (r >= 0) {
+            r = sd_bus_message_close_container(m);
+        }
+        if (r >= 0) {
+            r = sd_bus_message_close_container(m);
+        }
+    }
+    if (r >= 0) {
+        r = sd_bus_message_close_container(m);
+    }
+    if (r >= 0) {
+        r = sd_bus_message_seal(m, snapshot_version, 0);
+    }
+
+end:
+    if (r < 0) {
+        WARN("Failed to build snapshot: %s\n", strerror(-r));
+        sd_bus_message_unref(m);
+    } else {
+        snapshot_msg = m;
+    }
+    return r;
+}
+
+static int method_snapshot(sd_bus_message *m, UNUSED void *userdata, sd_bus_error *ret_error) {
+    uint64_t version = 0;
+    if (!strcmp(sd_bus_message_get_member(m), "SnapshotIfChanged")) {
+        VALIDATE_PARAMS(m, "t", &version);
+    }
+    
+    if (!snapshot_msg && build_snapshot() < 0) {
+        sd_bus_error_set_errno(ret_error, ENOMEM);
+        return -ENOMEM;
+    }
+    
+    sd_bus_message *reply = NULL;
+    int r = sd_bus_message_new_method_return(m, &reply);
+    if (r >= 0) {
+        if (version == snapshot_version) {
+            r = sd_bus_message_append(reply, "ta{sa{sv}}", snapshot_version, 0);
+        } else {
+            r = sd_bus_message_rewind(snapshot_msg, true);
+            if (r >= 0) {
+                r = sd_bus_message_copy(reply, snapshot_msg, true);
+            }
+        }
+    }
+    if (r >= 0) {
+        r = sd_bus_send(NULL, reply, NULL);
+    }
+    sd_bus_message_unref(reply);
+    return r;
 }
 
 static void lock_dtor(void *data) {
     lock_t *l = (lock_t *)data;
-    free((void *)l->app);
-    free((void *)l->reason);
+    unintern(l->key);
+    unintern(l->app);
+    unintern(l->reason);
     free(l);
 }
 
+/*
+ * Return a shared copy of str, to be released through unintern().
+ * Apps churning locks usually pass the same app name and reason over and over.
+ */
+static const char *intern(const char *str) {
+    if (!str) {
+        str = "";
+    }
+    interned_t *s = map_get(interned_map, str);
+    if (!s) {
+        const size_t len = strlen(str);
+        s = malloc(sizeof(interned_t) + len + 1);
+        if (!s) {
+            return NULL;
+        }
+        s->refs = 0;
+        memcpy(s->str, str, len + 1);
+        if (map_put(interned_map, str, s) != MAP_OK) {
+            free(s);
+            return NULL;
+        }
+    }
+    s->refs++;
+    return s->str;
+}
+
+static void unintern(const char *str) {
+    interned_t *s = str ? map_get(interned_map, str) : NULL;
+    if (s && --s->refs == 0) {
+        map_remove(interned_map, str);
+    }
+}
+
+/* 
+ * Cookies are allocated sequentially starting from a random seed,
+ * skipping 0, CLIGHT_COOKIE and any cookie still in use.
+ */
+static int new_cookie(void) {
+    static uint32_t last;
+    if (last == 0) {
+        last = random();
+    }
+    
+    char key[16];
+    do {
+        last++;
+        snprintf(key, sizeof(key), "%d", (int)last);
+    } while (last == 0 || (int)last == CLIGHT_COOKIE || map_has_key(cookie_map, key));
+    return last;
+}
+
+static lock_t *get_lock_by_cookie(int cookie) {
+    char key[16];
+    snprintf(key, sizeof(key), "%d", cookie);
+    return map_get(cookie_map, key);
+}
+
 /** org.freedesktop.ScreenSaver spec implementation: https://people.freedesktop.org/~hadess/idle-inhibition-spec/re01.html **/
 
 /* 
@@ -583,32 +1197,41 @@ static int create_inhibit(int *cookie, const char *key, const char *app_name, co
         l->refs++;
         *cookie = l->cookie;
     } else {
-        lock_t *l = malloc(sizeof(lock_t));
+        l = calloc(1, sizeof(lock_t));
         if (l) {
-            if (*cookie != CLIGHT_COOKIE) {
-                *cookie = random();
-            }
-            l->cookie = *cookie;
-            l->refs = 1;
-            l->app = strdup(app_name);
-            l->reason = strdup(reason);
-            map_put(lock_map, key, l);
-
-            inhibit_req.inhibit.old = state.inhibited;
-            inhibit_req.inhibit.new = true;
-            inhibit_req.inhibit.force = false;
-            inhibit_req.inhibit.app_name = strdup(app_name);
-            inhibit_req.inhibit.reason = strdup(reason);
-            M_PUB(&inhibit_req);
-
-            if (map_length(lock_map) == 1) {
-                /* Start listening on NameOwnerChanged signals */
-                USERBUS_ARG(args, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "NameOwnerChanged");
-                add_match(&args, &lock_slot, on_bus_name_changed);
+            l->key = intern(key);
+            l->app = intern(app_name);
+            l->reason = intern(reason);
+        }
+        if (!l || !l->key || !l->app || !l->reason || map_put(lock_map, key, l) != MAP_OK) {
+            if (l) {
+                lock_dtor(l);
             }
-        } else {
             return -1;
         }
+        
+        if (*cookie != CLIGHT_COOKIE) {
+            *cookie = new_cookie();
+        }
+        l->cookie = *cookie;
+        l->refs = 1;
+        char cookie_key[16];
+        snprintf(cookie_key, sizeof(cookie_key), "%d", l->cookie);
+        map_put(cookie_map, cookie_key, l);
+
+        inhibit_req.inhibit.old = cur_state.inhibited;
+        inhibit_req.inhibit.new = true;
+        inhibit_req.inhibit.force = false;
+        inhibit_req.inhibit.app_name = strdup(l->app);
+        inhibit_req.inhibit.reason = strdup(l->reason);
+        relay_publish(&inhibit_req);
+
+        if (map_length(lock_map) == 1) {
+            /* Start listening on NameOwnerChanged signals */
+            USERBUS_ARG(args, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "NameOwnerChanged");
+            args.bus = userbus;
+            add_match(&args, &lock_slot, on_bus_name_changed);
+        }
     }
     return 0;
 }
@@ -616,15 +1239,8 @@ static int create_inhibit(int *cookie, const char *key, const char *app_name, co
 static int drop_inhibit(int *cookie, const char *key, bool force) {
     lock_t *l = map_get(lock_map, key);
     if (!l && cookie) {
-        /* May be another sender is asking to drop a cookie? Linear search */
-        for (map_itr_t *itr = map_itr_new(lock_map); itr; itr = map_itr_next(itr)) {
-            lock_t *tmp = (lock_t *)map_itr_get_data(itr);
-            if (tmp->cookie == *cookie) {
-                l = tmp;
-                free(itr);
-                itr = NULL;
-            }
-        }
+        /* May be another sender is asking to drop a cookie? */
+        l = get_lock_by_cookie(*cookie);
     }
 
     if (l) {
@@ -635,14 +1251,24 @@ static int drop_inhibit(int *cookie, const char *key, bool force) {
         }
         if (l->refs == 0) {
             DEBUG("Dropped ScreenSaver inhibition held by cookie: %d.\n", l->cookie);
-            inhibit_req.inhibit.old = state.inhibited;
+            inhibit_req.inhibit.old = cur_state.inhibited;
             inhibit_req.inhibit.new = false;
-            inhibit_req.inhibit.force = !strcmp(key, CLIGHT_INH_KEY); // forcefully disable inhibition for Clight INTERFACE Inhibit "false"
+            inhibit_req.inhibit.force = !strcmp(l->key, CLIGHT_INH_KEY); // forcefully disable inhibition for Clight INTERFACE Inhibit "false"
             inhibit_req.inhibit.app_name = strdup(l->app);
             inhibit_req.inhibit.reason = strdup(l->reason);
-            M_PUB(&inhibit_req);
+            relay_publish(&inhibit_req);
             
-            map_remove(lock_map, key);
+            char cookie_key[16];
+            snprintf(cookie_key, sizeof(cookie_key), "%d", l->cookie);
+            map_remove(cookie_map, cookie_key);
+            /* 
+             * Remove lock by its owner, as key may be another sender;
+             * copy it as l->key is released by lock_dtor while removing.
+             */
+            char owner[PATH_MAX + 1];
+            strncpy(owner, l->key, PATH_MAX);
+            owner[PATH_MAX] = '\0';
+            map_remove(lock_map, owner);
             if (map_length(lock_map) == 0) {
                 /* Stop listening on NameOwnerChanged signals */
                 lock_slot = sd_bus_slot_unref(lock_slot);
@@ -653,11 +1279,8 @@ static int drop_inhibit(int *cookie, const char *key, bool force) {
     return -1;
 }
 
-static int method_clight_inhibit(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
-    int inhibit;
-    VALIDATE_PARAMS(m, "b", &inhibit);
-    
-    if (!conf.inh_conf.disabled) {
+static int clight_inhibit(bool inhibit) {
+    if (!cur_conf.inh_conf.disabled) {
         int ret = 0;
         if (inhibit) {
             int cookie = CLIGHT_COOKIE;
@@ -665,14 +1288,32 @@ static int method_clight_inhibit(sd_bus_message *m, void *userdata, sd_bus_error
         } else {
             ret = drop_inhibit(NULL, CLIGHT_INH_KEY, true);
         }
+        return ret == 0 ? 0 : -EINVAL;
+    }
+    WARN("Inhibit module is disabled.\n");
+    return -EINVAL;
+}
 
-        if (ret == 0) {
-            return sd_bus_reply_method_return(m, NULL);
-        }
-    } else {
-        WARN("Inhibit module is disabled.\n");
+static int method_clight_inhibit(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    int inhibit;
+    VALIDATE_PARAMS(m, "b", &inhibit);
+    
+    r = clight_inhibit(inhibit);
+    if (r == 0) {
+        return sd_bus_reply_method_return(m, NULL);
+    }
+    sd_bus_error_set_errno(ret_error, -r);
+    return r;
+}
+
+/* Publish a BL_REQ changing current backlight level by change_pct (positive or negative) */
+static int change_backlight(double change_pct) {
+    if (fabs(change_pct) > 0.0 && fabs(change_pct) < 1.0) {
+        bl_req.bl.smooth = -1;
+        bl_req.bl.new = clamp(cur_state.current_bl_pct + change_pct, 1.0, 0.0);
+        relay_publish(&bl_req);
+        return 0;
     }
-    sd_bus_error_set_errno(ret_error, EINVAL);
     return -EINVAL;
 }
 
@@ -680,22 +1321,13 @@ static int method_clight_changebl(sd_bus_message *m, void *userdata, sd_bus_erro
     double change_pct;
     VALIDATE_PARAMS(m, "d", &change_pct);
     
-    if (change_pct > 0.0 && change_pct < 1.0) {
-        bl_req.bl.smooth = -1;
-        
-        if (!strcmp(sd_bus_message_get_member(m), "IncBl")) {
-            bl_req.bl.new = state.current_bl_pct + change_pct;
-            if (bl_req.bl.new > 1.0) {
-                bl_req.bl.new = 1.0;
-            }
-        } else {
-            bl_req.bl.new = state.current_bl_pct - change_pct;
-            if (bl_req.bl.new < 0.0) {
-                bl_req.bl.new = 0.0;
-            }
+    if (change_pct > 0.0) {
+        if (strcmp(sd_bus_message_get_member(m), "IncBl")) {
+            change_pct = -change_pct;
+        }
+        if (change_backlight(change_pct) == 0) {
+            return sd_bus_reply_method_return(m, NULL);
         }
-        M_PUB(&bl_req);
-        return sd_bus_reply_method_return(m, NULL);
     }
     sd_bus_error_set_errno(ret_error, EINVAL);
     return -EINVAL;
@@ -727,7 +1359,7 @@ static int method_uninhibit(sd_bus_message *m, void *userdata, sd_bus_error *ret
 }
 
 static int method_simulate_activity(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
-    M_PUB(&simulate_req);
+    relay_publish(&simulate_req);
     return sd_bus_reply_method_return(m, NULL);
 }
 
@@ -744,54 +1376,143 @@ static int get_version(sd_bus *b, const char *path, const char *interface, const
                        
 static int method_capture(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
     VALIDATE_PARAMS(m, "bb", &capture_req.capture.reset_timer, &capture_req.capture.capture_only);
-    M_PUB(&capture_req);
+    if (relay_publish(&capture_req) != 0) {
+        sd_bus_error_set_const(ret_error, SD_BUS_ERROR_FAILED, "Failed to request a capture.");
+        return -EAGAIN;
+    }
     return sd_bus_reply_method_return(m, NULL);
 }
 
+/*
+ * CaptureAndWait() replies with ambient brightness, compensated ambient brightness
+ * and backlight pct once capture is done.
+ * Reply is deferred until BACKLIGHT publishes CAPTURE_UPD:
+ * concurrent callers just join the capture already requested.
+ */
+static int method_capture_and_wait(sd_bus_message *m, UNUSED void *userdata, sd_bus_error *ret_error) {
+    if (cur_conf.bl_conf.disabled) {
+        sd_bus_error_set_const(ret_error, SD_BUS_ERROR_NOT_SUPPORTED, "Backlight module is disabled.");
+        return -EOPNOTSUPP;
+    }
+    
+    sd_bus_message **tmp = realloc(capture_waiters, (num_capture_waiters + 1) * sizeof(sd_bus_message *));
+    if (!tmp) {
+        sd_bus_error_set_errno(ret_error, ENOMEM);
+        return -ENOMEM;
+    }
+    capture_waiters = tmp;
+    if (num_capture_waiters == 0) {
+        capture_req.capture.reset_timer = true;
+        capture_req.capture.capture_only = false;
+        if (relay_publish(&capture_req) != 0) {
+            sd_bus_error_set_const(ret_error, SD_BUS_ERROR_FAILED, "Failed to request a capture.");
+            return -EAGAIN;
+        }
+        /* Never leave callers hanging, eg: if BACKLIGHT is not running */
+        set_timeout(CAPTURE_WAIT_TIMEOUT, 0, capture_fd, 0);
+    } else {
+        stats_count("interface:captures_joined");
+    }
+    capture_waiters[num_capture_waiters++] = sd_bus_message_ref(m);
+    /* Reply will be sent by reply_capture_waiters() */
+    return 1;
+}
+
+/* Reply to CaptureAndWait callers with capture result; up is NULL if none was received in time */
+static void reply_capture_waiters(const captured_upd *up) {
+    if (num_capture_waiters == 0) {
+        return;
+    }
+    if (up) {
+        set_timeout(0, 0, capture_fd, 0);
+    } else {
+        WARN("No capture result received in %ds.\n", CAPTURE_WAIT_TIMEOUT);
+    }
+    for (int i = 0; i < num_capture_waiters; i++) {
+        if (!up) {
+            sd_bus_reply_method_errorf(capture_waiters[i], SD_BUS_ERROR_TIMEOUT, "Capture timed out.");
+        } else if (up->ok) {
+            sd_bus_reply_method_return(capture_waiters[i], "ddd", up->ambient_br, up->compensated_br, up->bl_pct);
+        } else {
+            sd_bus_reply_method_errorf(capture_waiters[i], SD_BUS_ERROR_FAILED, "Capture failed.");
+        }
+        sd_bus_message_unref(capture_waiters[i]);
+    }
+    num_capture_waiters = 0;
+}
+
 static int method_load(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
     const char *module_path;
 
     VALIDATE_PARAMS(m, "s", &module_path);
-    if (m_load(module_path) == MOD_OK) {
-        INFO("'%s' loaded.\n", module_path);
-        return sd_bus_reply_method_return(m, NULL);
-    }
-
-    WARN("'%s' failed to load.\n", module_path);
-    sd_bus_error_set_errno(ret_error, EINVAL);
-    return -EINVAL;
+    return forward_call(m, RELAY_LOAD, module_path, ret_error);
 }
 
 static int method_unload(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
     const char *module_path;
 
     VALIDATE_PARAMS(m, "s", &module_path);
-    if (m_unload(module_path) == MOD_OK) {
-        INFO("'%s' unloaded.\n", module_path);
-        return sd_bus_reply_method_return(m, NULL);
+    return forward_call(m, RELAY_UNLOAD, module_path, ret_error);
+}
+
+/*
+ * libmodule is not thread safe: let RELAY run the call on main context.
+ * m is replied once its result is sent back.
+ */
+static int forward_call(sd_bus_message *m, enum relay_calls call, const char *arg, sd_bus_error *ret_error) {
+    if (strlen(arg) > PATH_MAX) {
+        sd_bus_error_set_errno(ret_error, ENAMETOOLONG);
+        return -ENAMETOOLONG;
     }
+    if (relay_call(call, arg, m) != 0) {
+        sd_bus_error_set_errno(ret_error, EAGAIN);
+        return -EAGAIN;
+    }
+    sd_bus_message_ref(m);
+    return 1;
+}
 
-    WARN("'%s' failed to unload.\n", module_path);
-    sd_bus_error_set_errno(ret_error, EINVAL);
-    return -EINVAL;
+static void reply_relay_call(const relay_frame_t *f) {
+    sd_bus_message *m = (sd_bus_message *)f->call.cookie;
+    switch (f->call.call) {
+    case RELAY_LOAD:
+    case RELAY_UNLOAD: {
+        const char *what = f->call.call == RELAY_LOAD ? "load" : "unload";
+        if (f->call.ret == 0) {
+            INFO("'%s' %sed.\n", f->call.arg, what);
+            sd_bus_reply_method_return(m, NULL);
+        } else {
+            WARN("'%s' failed to %s.\n", f->call.arg, what);
+            sd_bus_reply_method_errno(m, -f->call.ret, NULL);
+        }
+        break;
+    }
+    case RELAY_STORE_CONF:
+        if (f->call.ret == 0) {
+            sd_bus_reply_method_return(m, NULL);
+        } else {
+            sd_bus_reply_method_errorf(m, SD_BUS_ERROR_FAILED, "Failed to store conf.");
+        }
+        break;
+    default:
+        break;
+    }
+    sd_bus_message_unref(m);
 }
 
 static int get_curve(sd_bus *bus, const char *path, const char *interface, const char *property,
                      sd_bus_message *reply, void *userdata, sd_bus_error *error) {
     
     enum ac_states st = ON_AC;
-    if (userdata == conf.sens_conf.regression_points[ON_BATTERY]) {
+    if (userdata == cur_conf.sens_conf.regression_points[ON_BATTERY]) {
         st = ON_BATTERY;
     }
-    return sd_bus_message_append_array(reply, 'd', userdata, conf.sens_conf.num_points[st] * sizeof(double));
+    return sd_bus_message_append_array(reply, 'd', userdata, cur_conf.sens_conf.num_points[st] * sizeof(double));
 }
 
 static int set_curve(sd_bus *bus, const char *path, const char *interface, const char *property,
                      sd_bus_message *value, void *userdata, sd_bus_error *error) {
 
-    /* Unref last curve message, if any */
-    curve_message = sd_bus_message_unref(curve_message);
-
     double *data = NULL;
     size_t length;
     int r = sd_bus_message_read_array(value, 'd', (const void**) &data, &length);
@@ -799,23 +1520,31 @@ static int set_curve(sd_bus *bus, const char *path, const char *interface, const
         WARN("Failed to parse parameters: %s\n", strerror(-r));
         return r;
     }
-    curve_req.curve.num_points = length / sizeof(double);
-    if (curve_req.curve.num_points > MAX_SIZE_POINTS) {
+    message_t *msg = curve_req(userdata);
+    msg->curve.num_points = length / sizeof(double);
+    if (msg->curve.num_points > MAX_SIZE_POINTS) {
         WARN("Wrong parameters.\n");
         sd_bus_error_set_const(error, SD_BUS_ERROR_FAILED, "Wrong parameters.");
         r = -EINVAL;
     } else {
-        curve_req.curve.state = ON_AC;
-        if (userdata == conf.sens_conf.regression_points[ON_BATTERY]) {
-            curve_req.curve.state = ON_BATTERY;
-        }
-        curve_req.curve.regression_points = data;
-        curve_message = sd_bus_message_ref(value);
-        M_PUB(&curve_req);
+        /* Points are copied by RELAY: value can be released right away */
+        msg->curve.regression_points = data;
+        relay_publish(msg);
     }
     return r;
 }
 
+/* Each ac state has its own curve request, so that both can be set at once */
+static message_t *curve_req(const void *data) {
+    message_t *msg = &ac_curve_req;
+    msg->curve.state = ON_AC;
+    if (data == cur_conf.sens_conf.regression_points[ON_BATTERY]) {
+        msg = &batt_curve_req;
+        msg->curve.state = ON_BATTERY;
+    }
+    return msg;
+}
+
 static int get_location(sd_bus *bus, const char *path, const char *interface, const char *property,
                         sd_bus_message *reply, void *userdata, sd_bus_error *error) {
     loc_t *l = (loc_t *)userdata;
@@ -828,62 +1557,68 @@ static int set_location(sd_bus *bus, const char *path, const char *interface, co
     VALIDATE_PARAMS(value, "(dd)", &loc_req.loc.new.lat, &loc_req.loc.new.lon);
 
     DEBUG("New location from BUS api: %.2lf %.2lf\n", loc_req.loc.new.lat, loc_req.loc.new.lat);
-    M_PUB(&loc_req);
+    relay_publish(&loc_req);
     return r;
 }
 
-static int set_timeouts(sd_bus *bus, const char *path, const char *interface, const char *property,
-                            sd_bus_message *value, void *userdata, sd_bus_error *error) {    
-    /* Check if we modified currently used timeout! */
+/* Return the request to be published for a timeout conf field, with its state (and daytime) set */
+static message_t *timeout_req(const void *data) {
     message_t *msg = NULL;
-    if (userdata == &conf.bl_conf.timeout[ON_AC][DAY]) {
+    if (data == &cur_conf.bl_conf.timeout[ON_AC][DAY]) {
         msg = &bl_to_req;
         bl_to_req.to.daytime = DAY;
         bl_to_req.to.state = ON_AC;
-    } else if (userdata == &conf.bl_conf.timeout[ON_AC][NIGHT]) {
+    } else if (data == &cur_conf.bl_conf.timeout[ON_AC][NIGHT]) {
         msg = &bl_to_req;
         bl_to_req.to.daytime = NIGHT;
         bl_to_req.to.state = ON_AC;
-    } else if (userdata == &conf.bl_conf.timeout[ON_AC][IN_EVENT]) {
+    } else if (data == &cur_conf.bl_conf.timeout[ON_AC][IN_EVENT]) {
         msg = &bl_to_req;
         bl_to_req.to.daytime = IN_EVENT;
         bl_to_req.to.state = ON_AC;
-    } else if (userdata == &conf.bl_conf.timeout[ON_BATTERY][DAY]) {
+    } else if (data == &cur_conf.bl_conf.timeout[ON_BATTERY][DAY]) {
         msg = &bl_to_req;
         bl_to_req.to.daytime = DAY;
         bl_to_req.to.state = ON_BATTERY;
-    } else if (userdata == &conf.bl_conf.timeout[ON_BATTERY][NIGHT]) {
+    } else if (data == &cur_conf.bl_conf.timeout[ON_BATTERY][NIGHT]) {
         msg = &bl_to_req;
         bl_to_req.to.daytime = NIGHT;
         bl_to_req.to.state = ON_BATTERY;
-    } else if (userdata == &conf.bl_conf.timeout[ON_BATTERY][IN_EVENT]) {
+    } else if (data == &cur_conf.bl_conf.timeout[ON_BATTERY][IN_EVENT]) {
         msg = &bl_to_req;
         bl_to_req.to.daytime = IN_EVENT;
         bl_to_req.to.state = ON_BATTERY;
-    } else if (userdata == &conf.dim_conf.timeout[ON_AC]) {
+    } else if (data == &cur_conf.dim_conf.timeout[ON_AC]) {
         msg = &dimmer_to_req;
         dimmer_to_req.to.state = ON_AC;
-    } else if (userdata == &conf.dim_conf.timeout[ON_BATTERY]) {
+    } else if (data == &cur_conf.dim_conf.timeout[ON_BATTERY]) {
         msg = &dimmer_to_req;
         dimmer_to_req.to.state = ON_BATTERY;
-    } else if (userdata == &conf.dpms_conf.timeout[ON_AC]) {
+    } else if (data == &cur_conf.dpms_conf.timeout[ON_AC]) {
         msg = &dpms_to_req;
         dpms_to_req.to.state = ON_AC;
-    } else if (userdata == &conf.dpms_conf.timeout[ON_BATTERY]) {
+    } else if (data == &cur_conf.dpms_conf.timeout[ON_BATTERY]) {
         msg = &dpms_to_req;
-        dimmer_to_req.to.state = ON_BATTERY;
-    } else if (userdata == &conf.screen_conf.timeout[ON_AC]) {
+        dpms_to_req.to.state = ON_BATTERY;
+    } else if (data == &cur_conf.screen_conf.timeout[ON_AC]) {
         msg = &scr_to_req;
         scr_to_req.to.state = ON_AC;
-    } else if (userdata == &conf.screen_conf.timeout[ON_BATTERY]) {
+    } else if (data == &cur_conf.screen_conf.timeout[ON_BATTERY]) {
         msg = &scr_to_req;
         scr_to_req.to.state = ON_BATTERY;
     }
+    return msg;
+}
+
+static int set_timeouts(sd_bus *bus, const char *path, const char *interface, const char *property,
+                            sd_bus_message *value, void *userdata, sd_bus_error *error) {    
+    /* Check if we modified currently used timeout! */
+    message_t *msg = timeout_req(userdata);
     
     VALIDATE_PARAMS(value, "i", &msg->to.new);
 
     if (msg) {
-        M_PUB(msg);
+        relay_publish(msg);
     }
     return r;
 }
@@ -892,9 +1627,9 @@ static int set_gamma(sd_bus *bus, const char *path, const char *interface, const
                      sd_bus_message *value, void *userdata, sd_bus_error *error) {
     VALIDATE_PARAMS(value, "i", &temp_req.temp.new);
     
-    temp_req.temp.daytime = userdata == &conf.gamma_conf.temp[DAY] ? DAY : NIGHT;
+    temp_req.temp.daytime = userdata == &cur_conf.gamma_conf.temp[DAY] ? DAY : NIGHT;
     temp_req.temp.smooth = -1; // use conf values
-    M_PUB(&temp_req);
+    relay_publish(&temp_req);
     return r;
 }
 
@@ -902,7 +1637,7 @@ static int set_auto_calib(sd_bus *bus, const char *path, const char *interface,
                           sd_bus_message *value, void *userdata, sd_bus_error *error) {
     VALIDATE_PARAMS(value, "b", &calib_req.nocalib.new);
     
-    M_PUB(&calib_req);
+    relay_publish(&calib_req);
     return r;
 }
 
@@ -912,11 +1647,11 @@ static int set_event(sd_bus *bus, const char *path, const char *interface, const
     VALIDATE_PARAMS(value, "s", &event);
 
     message_t *msg = &sunrise_req;
-    if (userdata == &conf.day_conf.day_events[SUNSET]) {
+    if (userdata == &cur_conf.day_conf.day_events[SUNSET]) {
         msg = &sunset_req;
     }
     strncpy(msg->event.event, event, sizeof(msg->event.event));
-    M_PUB(msg);
+    relay_publish(msg);
     return r;
 }
 
@@ -924,16 +1659,518 @@ static int set_screen_contrib(sd_bus *bus, const char *path, const char *interfa
                      sd_bus_message *value, void *userdata, sd_bus_error *error) {
     VALIDATE_PARAMS(value, "d", &contrib_req.contrib.new);
 
-    M_PUB(&contrib_req);
+    relay_publish(&contrib_req);
     return r;
 }
 
+/*
+ * Setter for conf properties that no module request is needed for.
+ * Conf is read by main context modules at any time: let RELAY write it from there.
+ */
+static int set_conf(sd_bus *bus, const char *path, const char *interface, const char *property,
+                    sd_bus_message *value, void *userdata, sd_bus_error *error) {
+    union {
+        int i;
+        double d;
+        const char *s;
+    } val;
+    char type;
+    
+    int r = sd_bus_message_peek_type(value, &type, NULL);
+    if (r >= 0) {
+        r = sd_bus_message_read_basic(value, type, &val);
+    }
+    if (r >= 0) {
+        r = write_conf(userdata, type, &val);
+    }
+    if (r < 0) {
+        WARN("Failed to set %s: %s\n", property, strerror(-r));
+    }
+    return r;
+}
+
+/*
+ * Write a cur_conf field to conf, through RELAY; val points to an int, a double or a string.
+ * cur_conf is written too, so that a read right after a write sees it.
+ */
+static int write_conf(void *data, const char type, const void *val) {
+    const size_t offset = (uint8_t *)data - (uint8_t *)&cur_conf;
+    size_t len;
+    char str[PATH_MAX + 1];
+    switch (type) {
+    case SD_BUS_TYPE_BOOLEAN:
+    case SD_BUS_TYPE_INT32:
+        len = sizeof(int);
+        break;
+    case SD_BUS_TYPE_DOUBLE:
+        len = sizeof(double);
+        break;
+    case SD_BUS_TYPE_STRING: {
+        size_t size = sizeof(cur_conf.day_conf.day_events[0]);
+        if (data == cur_conf.bl_conf.screen_path || data == cur_conf.sens_conf.dev_name) {
+            size = PATH_MAX + 1;
+        } else if (data == cur_conf.sens_conf.dev_opts) {
+            size = NAME_MAX + 1;
+        }
+        strncpy(str, *(const char **)val, size - 1);
+        str[size - 1] = '\0';
+        val = str;
+        len = strlen(str) + 1;
+        break;
+    }
+    default:
+        return -EOPNOTSUPP;
+    }
+    if (relay_set_conf(offset, val, len) != 0) {
+        return -EAGAIN;
+    }
+    memcpy(data, val, len);
+    invalidate_snapshot();
+    return 0;
+}
+
+/* Conf is owned by main context: store it from there */
 static int method_store_conf(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
-    int r = -1;
-    if (store_config(LOCAL) == 0) {
-        r = sd_bus_reply_method_return(m, NULL);
-    } else {
-        sd_bus_error_set_const(ret_error, SD_BUS_ERROR_FAILED, "Failed to store conf.");
+    return forward_call(m, RELAY_STORE_CONF, "", ret_error);
+}
+
+/*
+ * Conf.SetMany(a{sv}): set many Conf properties at once, keyed by "Object.Property"
+ * relative to Conf object, eg: "Backlight.AcDayTimeout", or just "Verbose".
+ * All values are validated, through the same checks modules run on their requests,
+ * before anything is applied; if any of them fails, nothing changes.
+ * Then each module reacts once:
+ * for each group of changes handled by the same request (eg: BACKLIGHT timeouts),
+ * only the one currently in use (or else the last one) is published,
+ * while the others are written straight to conf, as they would be stored anyway.
+ */
+static int method_set_many(sd_bus_message *m, UNUSED void *userdata, sd_bus_error *ret_error) {
+    conf_change_t changes[MAX_CONF_CHANGES];
+    int num_changes = 0;
+    
+    int r = sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY, "{sv}");
+    while (r >= 0 && (r = sd_bus_message_enter_container(m, SD_BUS_TYPE_DICT_ENTRY, "sv")) > 0) {
+        const char *key = NULL;
+        r = sd_bus_message_read(m, "s", &key);
+        if (r >= 0) {
+            if (num_changes == MAX_CONF_CHANGES) {
+                sd_bus_error_setf(ret_error, SD_BUS_ERROR_INVALID_ARGS, "Too many properties.");
+                r = -E2BIG;
+            } else {
+                r = parse_conf_change(m, key, &changes[num_changes++], ret_error);
+            }
+        }
+        if (r >= 0) {
+            r = sd_bus_message_exit_container(m);
+        }
+    }
+    if (r < 0) {
+        WARN("Failed to parse parameters: %s\n", strerror(-r));
+        if (!sd_bus_error_is_set(ret_error)) {
+            sd_bus_error_set_errno(ret_error, -r);
+        }
+        return r;
+    }
+    
+    /* Elect the change to be published for each group */
+    for (int i = 0; i < num_changes; i++) {
+        const void *group = conf_change_group(&changes[i]);
+        changes[i].publish = true;
+        for (int j = 0; j < num_changes && group && changes[i].publish; j++) {
+            if (j != i && conf_change_group(&changes[j]) == group) {
+                if (conf_change_is_current(&changes[j]) && (!conf_change_is_current(&changes[i]) || j > i)) {
+                    changes[i].publish = false;
+                } else if (j > i && !conf_change_is_current(&changes[i])) {
+                    changes[i].publish = false;
+                }
+            }
+        }
+    }
+    
+    /* Points arrays are read straight from m, and copied by RELAY */
+    for (int i = 0; i < num_changes && r >= 0; i++) {
+        r = apply_conf_change(&changes[i]);
+    }
+    if (r < 0) {
+        /* Main context is not receiving our requests: changes applied so far stay */
+        sd_bus_error_set_const(ret_error, SD_BUS_ERROR_FAILED, "Failed to apply conf changes.");
+        return r;
+    }
+    DEBUG("%d conf properties set from BUS api.\n", num_changes);
+    return sd_bus_reply_method_return(m, NULL);
+}
+
+/* Validate a single SetMany entry, and stage it in c */
+static int parse_conf_change(sd_bus_message *m, const char *key, conf_change_t *c, sd_bus_error *ret_error) {
+    static const char conf_iface_prefix[] = "org.clight.clight.Conf";
+    
+    const char *name = strrchr(key, '.');
+    const size_t obj_len = name ? name - key : 0;
+    name = name ? name + 1 : key;
+    
+    memset(c, 0, sizeof(conf_change_t));
+    for (int i = 0; i < num_snapshot_objs && !c->prop; i++) {
+        const char *iface = snapshot_objs[i].interface;
+        if (strncmp(iface, conf_iface_prefix, strlen(conf_iface_prefix))) {
+            continue;
+        }
+        iface += strlen(conf_iface_prefix);
+        if ((obj_len == 0 && *iface == '\0') || 
+            (obj_len > 0 && *iface == '.' && strlen(iface + 1) == obj_len && !strncmp(iface + 1, key, obj_len))) {
+            
+            for (const sd_bus_vtable *v = snapshot_objs[i].vtable; v->type != _SD_BUS_VTABLE_END; v++) {
+                if (v->type == _SD_BUS_VTABLE_WRITABLE_PROPERTY && !strcmp(v->x.property.member, name)) {
+                    c->prop = v;
+                    c->data = (uint8_t *)snapshot_objs[i].userdata + v->x.property.offset;
+                    break;
+                }
+            }
+        }
+    }
+    if (!c->prop) {
+        sd_bus_error_setf(ret_error, SD_BUS_ERROR_UNKNOWN_PROPERTY, "Unknown or read-only property '%s'.", key);
+        return -ENOENT;
+    }
+    
+    const char *sig = c->prop->x.property.signature;
+    int r = sd_bus_message_enter_container(m, SD_BUS_TYPE_VARIANT, sig);
+    if (r < 0) {
+        sd_bus_error_setf(ret_error, SD_BUS_ERROR_INVALID_ARGS, "Property '%s' has signature '%s'.", key, sig);
+        return r;
+    }
+    switch (sig[0]) {
+    case SD_BUS_TYPE_BOOLEAN:
+    case SD_BUS_TYPE_INT32:
+        r = sd_bus_message_read_basic(m, sig[0], &c->val.i);
+        break;
+    case SD_BUS_TYPE_DOUBLE:
+        r = sd_bus_message_read_basic(m, sig[0], &c->val.d);
+        break;
+    case SD_BUS_TYPE_STRING:
+        r = sd_bus_message_read_basic(m, sig[0], &c->val.s);
+        break;
+    case SD_BUS_TYPE_ARRAY: {
+        size_t length;
+        r = sd_bus_message_read_array(m, 'd', (const void **)&c->val.curve.points, &length);
+        c->val.curve.num = length / sizeof(double);
+        if (r >= 0 && c->val.curve.num > MAX_SIZE_POINTS) {
+            sd_bus_error_setf(ret_error, SD_BUS_ERROR_INVALID_ARGS, "Too many points for '%s'.", key);
+            r = -EINVAL;
+        }
+        break;
+    }
+    case SD_BUS_TYPE_STRUCT_BEGIN:
+        r = sd_bus_message_read(m, "(dd)", &c->val.loc.lat, &c->val.loc.lon);
+        break;
+    default:
+        r = -EOPNOTSUPP;
+        break;
+    }
+    if (r >= 0) {
+        r = sd_bus_message_exit_container(m);
+    }
+    if (r >= 0 && validate_conf_change(c) != 0) {
+        sd_bus_error_setf(ret_error, SD_BUS_ERROR_INVALID_ARGS, "Invalid value for '%s'.", key);
+        r = -EINVAL;
+    }
+    return r;
+}
+
+/*
+ * Run on a staged change the validation its module request would go through,
+ * whether it will be published or written straight to conf.
+ * Requests are copied with every field valued, as validations otherwise fill them from main context.
+ * Changes that would be a no-op (eg: same location) are not refused: their module just ignores them.
+ */
+static int validate_conf_change(const conf_change_t *c) {
+    const sd_bus_property_set_t set = c->prop->x.property.set;
+    message_t msg;
+    if (set == set_timeouts) {
+        memcpy(&msg, timeout_req(c->data), sizeof(message_t));
+        msg.to.new = c->val.i;
+        return -!VALIDATE_REQ(&msg.to);
+    }
+    if (set == set_gamma) {
+        memcpy(&msg, &temp_req, sizeof(message_t));
+        msg.temp.new = c->val.i;
+        msg.temp.daytime = c->data == &cur_conf.gamma_conf.temp[DAY] ? DAY : NIGHT;
+        msg.temp.smooth = 0;
+        return -!VALIDATE_REQ(&msg.temp);
+    }
+    if (set == set_event) {
+        memcpy(&msg, &sunrise_req, sizeof(message_t));
+        strncpy(msg.event.event, c->val.s, sizeof(msg.event.event) - 1);
+        msg.event.event[sizeof(msg.event.event) - 1] = '\0';
+        /* Truncated events are refused too */
+        return -(strlen(c->val.s) >= sizeof(msg.event.event) || !VALIDATE_REQ(&msg.event));
+    }
+    if (set == set_curve) {
+        memcpy(&msg, curve_req(c->data), sizeof(message_t));
+        msg.curve.regression_points = (double *)c->val.curve.points;
+        msg.curve.num_points = c->val.curve.num;
+        return -!VALIDATE_REQ(&msg.curve);
+    }
+    if (set == set_location) {
+        memcpy(&msg, &loc_req, sizeof(message_t));
+        msg.loc.new = c->val.loc;
+        if (get_distance(&msg.loc.new, &cur_state.current_loc) < 50) {
+            return 0;
+        }
+        return -!VALIDATE_REQ(&msg.loc);
+    }
+    if (set == set_auto_calib) {
+        memcpy(&msg, &calib_req, sizeof(message_t));
+        msg.nocalib.new = c->val.i;
+        return msg.nocalib.new == cur_conf.bl_conf.no_auto_calib ? 0 : -!VALIDATE_REQ(&msg.nocalib);
+    }
+    if (set == set_screen_contrib) {
+        memcpy(&msg, &contrib_req, sizeof(message_t));
+        msg.contrib.new = c->val.d;
+        return msg.contrib.new == cur_conf.screen_conf.contrib ? 0 : -!VALIDATE_REQ(&msg.contrib);
+    }
+    /* Plain conf values have no module validation */
+    return 0;
+}
+
+/* Changes applied by the same request, whose module should react only once */
+static const void *conf_change_group(const conf_change_t *c) {
+    const sd_bus_property_set_t set = c->prop->x.property.set;
+    if (set == set_timeouts) {
+        return timeout_req(c->data);
+    }
+    if (set == set_gamma) {
+        return &temp_req;
+    }
+    if (set == set_event) {
+        return &sunrise_req;
+    }
+    if (set == set_curve) {
+        /* Curves refit is per ac state */
+        return curve_req(c->data);
+    }
+    /* Other properties are unique */
+    return NULL;
+}
+
+/* Whether change targets conf currently in use, ie: the one its module reacts to */
+static bool conf_change_is_current(const conf_change_t *c) {
+    const sd_bus_property_set_t set = c->prop->x.property.set;
+    if (set == set_timeouts) {
+        const message_t *msg = timeout_req(c->data);
+        if (msg->to.state != cur_state.ac_state) {
+            return false;
+        }
+        return msg != &bl_to_req || 
+                msg->to.daytime == cur_state.day_time || (cur_state.in_event && msg->to.daytime == IN_EVENT);
+    }
+    if (set == set_gamma) {
+        return c->data == &cur_conf.gamma_conf.temp[cur_state.day_time];
+    }
+    return false;
+}
+
+/* Returns -EAGAIN if change could not be sent to main context */
+static int apply_conf_change(const conf_change_t *c) {
+    const sd_bus_property_set_t set = c->prop->x.property.set;
+    int r = 0;
+    if (set && set != set_conf && c->publish) {
+        if (set == set_timeouts) {
+            message_t *msg = timeout_req(c->data);
+            msg->to.new = c->val.i;
+            r = relay_publish(msg);
+        } else if (set == set_gamma) {
+            temp_req.temp.new = c->val.i;
+            temp_req.temp.daytime = c->data == &cur_conf.gamma_conf.temp[DAY] ? DAY : NIGHT;
+            temp_req.temp.smooth = -1; // use conf values
+            r = relay_publish(&temp_req);
+        } else if (set == set_event) {
+            message_t *msg = c->data == &cur_conf.day_conf.day_events[SUNSET] ? &sunset_req : &sunrise_req;
+            strncpy(msg->event.event, c->val.s, sizeof(msg->event.event));
+            r = relay_publish(msg);
+        } else if (set == set_curve) {
+            message_t *msg = curve_req(c->data);
+            msg->curve.regression_points = (double *)c->val.curve.points;
+            msg->curve.num_points = c->val.curve.num;
+            r = relay_publish(msg);
+        } else if (set == set_location) {
+            loc_req.loc.new = c->val.loc;
+            r = relay_publish(&loc_req);
+        } else if (set == set_auto_calib) {
+            calib_req.nocalib.new = c->val.i;
+            r = relay_publish(&calib_req);
+        } else if (set == set_screen_contrib) {
+            contrib_req.contrib.new = c->val.d;
+            r = relay_publish(&contrib_req);
+        }
+        return r == 0 ? 0 : -EAGAIN;
+    }
+    
+    /* Write straight to conf, as set_conf() does */
+    return write_conf(c->data, c->prop->x.property.signature[0], &c->val);
+}
+
+/** Control socket api **/
+
+/*
+ * Listen for control clients on $XDG_RUNTIME_DIR/CLIGHT_CTL_SOCK.
+ * SOCK_SEQPACKET preserves message boundaries: each read is a whole request.
+ */
+static int start_control_socket(void) {
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if (!dir) {
+        errno = ENOENT;
+        return -1;
+    }
+    
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(ctl_path, PATH_MAX, "%s/%s", dir, CLIGHT_CTL_SOCK);
+    if (strlen(ctl_path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strncpy(addr.sun_path, ctl_path, sizeof(addr.sun_path) - 1);
+    
+    /* Create socket parent folder */
+    char *sep = strrchr(addr.sun_path, '/');
+    *sep = '\0';
+    if (mkdir(addr.sun_path, 0700) == -1 && errno != EEXIST) {
+        return -1;
+    }
+    *sep = '/';
+    
+    ctl_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (ctl_fd == -1) {
+        return -1;
+    }
+    /* Remove any stale socket left by a crashed instance */
+    unlink(ctl_path);
+    if (bind(ctl_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(ctl_fd, 4) == -1) {
+        close(ctl_fd);
+        ctl_fd = -1;
+        return -1;
+    }
+    m_register_fd(ctl_fd, true, &ctl_fd);
+    DEBUG("Serving control requests on %s.\n", ctl_path);
+    return 0;
+}
+
+static void control_accept(int fd) {
+    int client;
+    while ((client = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        if (ctl_clients < MAX_CTL_CLIENTS) {
+            ctl_clients++;
+            m_register_fd(client, true, &ctl_clients);
+        } else {
+            WARN("Too many control clients.\n");
+            close(client);
+        }
+    }
+}
+
+/*
+ * Serve any pending request from a client;
+ * client is dropped on disconnection or protocol errors.
+ */
+static void control_serve(int fd) {
+    clight_ctl_req_t req;
+    ssize_t len;
+    while ((len = recv(fd, &req, sizeof(req), 0)) == sizeof(req)) {
+        clight_ctl_resp_t resp = {
+            .status = control_handle(&req),
+            .ac_state = cur_state.ac_state,
+            .display_state = cur_state.display_state,
+            .lid_state = cur_state.lid_state,
+            .inhibited = cur_state.inhibited,
+            .temp = cur_state.current_temp,
+            .bl_pct = cur_state.current_bl_pct,
+            .kbd_pct = cur_state.current_kbd_pct,
+            .ambient_br = cur_state.ambient_br
+        };
+        if (send(fd, &resp, sizeof(resp), MSG_NOSIGNAL) != sizeof(resp)) {
+            /* Client is not reading its responses */
+            len = 0;
+            break;
+        }
+    }
+    
+    if (len >= 0 || errno != EAGAIN) {
+        if (len > 0) {
+            WARN("Malformed control request.\n");
+        }
+        ctl_clients--;
+        m_deregister_fd(fd);
+    }
+}
+
+static int control_handle(const clight_ctl_req_t *req) {
+    if (req->magic != CLIGHT_CTL_MAGIC || req->version != CLIGHT_CTL_VERSION) {
+        return -EPROTO;
+    }
+    
+    stats_count("control:requests");
+    switch (req->op) {
+    case CLIGHT_CTL_GET_STATE:
+        return 0;
+    case CLIGHT_CTL_INC_BL:
+        return req->arg > 0.0 ? change_backlight(req->arg) : -EINVAL;
+    case CLIGHT_CTL_DEC_BL:
+        return req->arg > 0.0 ? change_backlight(-req->arg) : -EINVAL;
+    case CLIGHT_CTL_CAPTURE:
+        capture_req.capture.reset_timer = !!(req->flags & CLIGHT_CTL_RESET_TIMER);
+        capture_req.capture.capture_only = !!(req->flags & CLIGHT_CTL_CAPTURE_ONLY);
+        relay_publish(&capture_req);
+        return 0;
+    case CLIGHT_CTL_INHIBIT:
+        return clight_inhibit(req->arg != 0.0);
+    default:
+        return -EOPNOTSUPP;
+    }
+}
+
+/** Stats bus api **/
+
+static void append_wakeup(const char *source, uint64_t count, double rate, void *userdata) {
+    sd_bus_message *reply = (sd_bus_message *)userdata;
+    sd_bus_message_append(reply, "{s(td)}", source, count, rate);
+}
+
+static int get_wakeups(sd_bus *bus, const char *path, const char *interface, const char *property,
+                       sd_bus_message *reply, void *userdata, sd_bus_error *error) {
+    int r = sd_bus_message_open_container(reply, SD_BUS_TYPE_ARRAY, "{s(td)}");
+    if (r >= 0) {
+        stats_foreach_wakeup(append_wakeup, reply);
+        r = sd_bus_message_close_container(reply);
     }
     return r;
 }
+
+static int get_uptime(sd_bus *bus, const char *path, const char *interface, const char *property,
+                      sd_bus_message *reply, void *userdata, sd_bus_error *error) {
+    return sd_bus_message_append(reply, "t", stats_uptime());
+}
+
+static int get_wakeups_window(sd_bus *bus, const char *path, const char *interface, const char *property,
+                              sd_bus_message *reply, void *userdata, sd_bus_error *error) {
+    return sd_bus_message_append(reply, "d", stats_window());
+}
+
+static void append_counter(const char *counter, uint64_t count, void *userdata) {
+    sd_bus_message *reply = (sd_bus_message *)userdata;
+    sd_bus_message_append(reply, "{st}", counter, count);
+}
+
+static int get_counters(sd_bus *bus, const char *path, const char *interface, const char *property,
+                        sd_bus_message *reply, void *userdata, sd_bus_error *error) {
+    int r = sd_bus_message_open_container(reply, SD_BUS_TYPE_ARRAY, "{st}");
+    if (r >= 0) {
+        stats_foreach_counter(append_counter, reply);
+        r = sd_bus_message_close_container(reply);
+    }
+    return r;
+}
+
+static int method_reset_stats(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
+    stats_reset();
+    INFO("Stats reset.\n");
+    return sd_bus_reply_method_return(m, NULL);
+}
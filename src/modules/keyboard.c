@@ -1,4 +1,5 @@
 #include "bus.h"
+#include "stats.h"
 
 static int init_kbd_backlight(void);
 static void set_keyboard_level(const double amb_br);
@@ -83,6 +84,11 @@ static void set_keyboard_level(const double amb_br) {
     kbd_msg.bl.old = state.current_kbd_pct;
     /* We actually need to pass an int to variadic bus() call */
     const int new_kbd_br = round(level * max_kbd_backlight);
+    if (new_kbd_br == round(state.current_kbd_pct * max_kbd_backlight)) {
+        /* Still issued, as keyboard backlight may have been changed by someone else meanwhile */
+        stats_count("keyboard:redundant");
+    }
+    stats_count("keyboard:issued");
     if (call(&kbd_args, NULL, "i", new_kbd_br) == 0) {
         state.current_kbd_pct = level;
         kbd_msg.bl.new = state.current_kbd_pct;
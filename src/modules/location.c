@@ -8,6 +8,7 @@ static int geoclue_get_client(void);
 static int geoclue_hook_update(void);
 static int on_geoclue_new_location(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 static int geoclue_client_start(void);
+static void geoclue_client_stop(void);
 static void geoclue_client_delete(void);
 static void cache_location(void);
 static void publish_location(double new_lat, double new_lon, message_t *l);
@@ -23,6 +24,7 @@ MODULE("LOCATION");
 static void init(void) {
     init_cache_file();
     M_SUB(LOCATION_REQ);
+    M_SUB(DEEP_IDLE_UPD);
 }
 
 static bool check(void) {
@@ -64,6 +66,18 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
         }
         break;
     }
+    case DEEP_IDLE_UPD: {
+        /* Location cannot change while nobody is looking at the screen: stop geoclue updates */
+        deep_idle_upd *up = (deep_idle_upd *)MSG_DATA();
+        if (strlen(client)) {
+            if (up->new) {
+                geoclue_client_stop();
+            } else {
+                geoclue_client_start();
+            }
+        }
+        break;
+    }
     case SYSTEM_UPD:
         if (msg->ps_msg->type == LOOP_STARTED) {
             if (geoclue_init() == 0) {
@@ -190,11 +204,18 @@ static int geoclue_client_start(void) {
 }
 
 /*
- * Stop and delete geoclue2 client.
+ * Stop geoclue2 client, without deleting it.
  */
-static void geoclue_client_delete(void) {
+static void geoclue_client_stop(void) {
     SYSBUS_ARG(stop_args, "org.freedesktop.GeoClue2", client, "org.freedesktop.GeoClue2.Client", "Stop");
     call(&stop_args, NULL);
+}
+
+/*
+ * Stop and delete geoclue2 client.
+ */
+static void geoclue_client_delete(void) {
+    geoclue_client_stop();
 
     SYSBUS_ARG(del_args, "org.freedesktop.GeoClue2", "/org/freedesktop/GeoClue2/Manager", "org.freedesktop.GeoClue2.Manager", "DeleteClient");
     call(&del_args, "o", client);
@@ -0,0 +1,200 @@
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include "stats.h"
+
+#define METRICS_DIR         "clight"
+#define METRICS_SOCK        "metrics.sock"
+#define METRICS_BUF_SIZE    4096        // initial render buffer size; grown (and kept) as needed
+
+static void serve_client(int fd);
+static void render(void);
+static void append(const char *fmt, ...);
+static void render_wakeup(const char *source, uint64_t count, double rate, void *userdata);
+static void render_counter(const char *counter, uint64_t count, void *userdata);
+static void render_histogram(const char *hist, const uint64_t *buckets, uint64_t count, double sum, void *userdata);
+
+static char sock_path[PATH_MAX + 1];
+static char *buf;                       // render buffer, reused by each scrape
+static size_t buf_size, buf_len;
+
+MODULE("METRICS");
+
+static void init(void) {
+    char dir[PATH_MAX + 1];
+    snprintf(dir, PATH_MAX, "%s/%s", getenv("XDG_RUNTIME_DIR"), METRICS_DIR);
+    snprintf(sock_path, PATH_MAX, "%s/%s", dir, METRICS_SOCK);
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd = -1;
+    buf = malloc(METRICS_BUF_SIZE);
+    if (buf && (mkdir(dir, 0700) == 0 || errno == EEXIST)
+        && strlen(sock_path) < sizeof(addr.sun_path)) {
+
+        strncpy(addr.sun_path, sock_path, sizeof(addr.sun_path) - 1);
+        buf_size = METRICS_BUF_SIZE;
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    }
+    if (fd != -1) {
+        /* Remove any stale socket left by a crashed instance */
+        unlink(sock_path);
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, 4) == -1) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    if (fd != -1) {
+        m_register_fd(fd, true, NULL);
+        DEBUG("Serving metrics on %s.\n", sock_path);
+    } else {
+        WARN("Failed to listen on %s: %s.\n", sock_path, strerror(errno));
+        m_poisonpill(self());
+    }
+}
+
+static bool check(void) {
+    return getenv("XDG_RUNTIME_DIR") != NULL;
+}
+
+static bool evaluate(void) {
+    return conf.metrics && !conf.wizard;
+}
+
+static void destroy(void) {
+    if (buf) {
+        unlink(sock_path);
+    }
+    free(buf);
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case FD_UPD: {
+        int fd;
+        /* Serve any pending client */
+        while ((fd = accept4(msg->fd_msg->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+            serve_client(fd);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/*
+ * Plain text protocol: write a whole scrape and close connection.
+ * Client socket is non blocking: a slow reader must not stall the daemon,
+ * thus a client that cannot take the whole scrape at once is dropped.
+ */
+static void serve_client(int fd) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    stats_wakeup("metrics:scrape");
+    render();
+    size_t written = 0;
+    while (written < buf_len) {
+        const ssize_t w = send(fd, buf + written, buf_len - written, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (w <= 0) {
+            if (w == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                stats_count("metrics:clients_dropped");
+            }
+            DEBUG("Failed to send metrics: %s.\n", strerror(errno));
+            break;
+        }
+        written += w;
+    }
+    close(fd);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    stats_observe("metrics_scrape", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+static void render(void) {
+    buf_len = 0;
+
+    append("# TYPE clight_uptime_seconds gauge\n");
+    append("clight_uptime_seconds %" PRIu64 "\n", stats_uptime());
+
+    append("# TYPE clight_ambient_brightness gauge\n");
+    append("clight_ambient_brightness %.3lf\n", state.ambient_br);
+    append("# TYPE clight_screen_compensation gauge\n");
+    append("clight_screen_compensation %.3lf\n", state.screen_comp);
+    append("# TYPE clight_backlight_pct gauge\n");
+    append("clight_backlight_pct %.3lf\n", state.current_bl_pct);
+    append("# TYPE clight_keyboard_pct gauge\n");
+    append("clight_keyboard_pct %.3lf\n", state.current_kbd_pct);
+    append("# TYPE clight_temperature_kelvin gauge\n");
+    append("clight_temperature_kelvin %d\n", state.current_temp);
+    append("# TYPE clight_ac_state gauge\n");
+    append("clight_ac_state %d\n", state.ac_state);
+    append("# TYPE clight_lid_state gauge\n");
+    append("clight_lid_state %d\n", state.lid_state);
+    append("# TYPE clight_display_state gauge\n");
+    append("clight_display_state %d\n", state.display_state);
+    append("# TYPE clight_inhibited gauge\n");
+    append("clight_inhibited %d\n", state.inhibited);
+
+    append("# TYPE clight_wakeups_window_seconds gauge\n");
+    append("clight_wakeups_window_seconds %.3lf\n", stats_window());
+    append("# TYPE clight_wakeups counter\n");
+    stats_foreach_wakeup(render_wakeup, NULL);
+    append("# TYPE clight_events counter\n");
+    stats_foreach_counter(render_counter, NULL);
+    append("# TYPE clight_latency_seconds histogram\n");
+    stats_foreach_histogram(render_histogram, NULL);
+
+    append("# EOF\n");
+}
+
+/*
+ * Append a formatted string to render buffer.
+ * Buffer is only grown when a scrape does not fit, then kept for next ones.
+ */
+static void append(const char *fmt, ...) {
+    va_list args;
+    for (;;) {
+        va_start(args, fmt);
+        const int len = vsnprintf(buf + buf_len, buf_size - buf_len, fmt, args);
+        va_end(args);
+        if (len < 0) {
+            return;
+        }
+        if (buf_len + len < buf_size) {
+            buf_len += len;
+            return;
+        }
+        char *tmp = realloc(buf, buf_size * 2);
+        if (!tmp) {
+            /* Drop this line */
+            buf[buf_len] = '\0';
+            return;
+        }
+        buf = tmp;
+        buf_size *= 2;
+    }
+}
+
+static void render_wakeup(const char *source, uint64_t count, UNUSED double rate, UNUSED void *userdata) {
+    append("clight_wakeups_total{source=\"%s\"} %" PRIu64 "\n", source, count);
+}
+
+static void render_counter(const char *counter, uint64_t count, UNUSED void *userdata) {
+    append("clight_events_total{name=\"%s\"} %" PRIu64 "\n", counter, count);
+}
+
+/* OpenMetrics buckets are cumulative */
+static void render_histogram(const char *hist, const uint64_t *buckets, uint64_t count, double sum, UNUSED void *userdata) {
+    uint64_t cumulative = 0;
+    for (int i = 0; i < STATS_HIST_BUCKETS - 1; i++) {
+        cumulative += buckets[i];
+        append("clight_latency_seconds_bucket{op=\"%s\",le=\"%g\"} %" PRIu64 "\n", hist, stats_hist_bounds[i], cumulative);
+    }
+    append("clight_latency_seconds_bucket{op=\"%s\",le=\"+Inf\"} %" PRIu64 "\n", hist, count);
+    append("clight_latency_seconds_count{op=\"%s\"} %" PRIu64 "\n", hist, count);
+    append("clight_latency_seconds_sum{op=\"%s\"} %lf\n", hist, sum);
+}
@@ -0,0 +1,363 @@
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include "relay.h"
+#include "config.h"
+#include "stats.h"
+
+/*
+ * INTERFACE runs on IFACE_CTX, in its own thread, with its own bus connection:
+ * blocking calls made by any other module cannot delay bus api replies.
+ * Pubsub is per-context, thus RELAY forwards any update to INTERFACE,
+ * and publishes on main context any request coming from INTERFACE.
+ * Messages are copied through a SOCK_SEQPACKET socketpair, never blocking the sender.
+ * Anything else touching libmodule or main context data (eg: loading a module)
+ * is run here too, and its result is sent back to INTERFACE.
+ * Conf is owned by main context as well: INTERFACE writes it through RELAY,
+ * and reads a copy, refreshed on each update and once modules reacted to its requests.
+ * INTERFACE applies its own writes to its copy straight away: a refresh is skipped
+ * until main context applied all of them, so that a read after a write always sees it.
+ */
+
+#define CONF_SYNC_MS 20     // conf copy is refreshed this many ms after last request from INTERFACE
+
+static void receive_frames(int fd);
+static void publish_request(const relay_frame_t *f);
+static void run_call(relay_frame_t *f);
+static bool write_conf(const relay_frame_t *f);
+static void share_conf(bool notify);
+static size_t frame_len(const relay_frame_t *f);
+static int send_frame(int fd, const relay_frame_t *f);
+static void *iface_loop(void *data);
+
+static int fds[2] = { -1, -1 };     // [0] is used by main context, [1] by IFACE_CTX
+static pthread_t iface_thread;
+static state_t shared_state;        // state copy, updated before forwarding each update
+static conf_t shared_conf;          // conf copy, updated before forwarding each update and after conf writes
+static pthread_mutex_t shared_mtx = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t writes_applied;     // conf writes received by main context, at the time shared_conf was copied
+static uint64_t writes_received;    // conf writes received by main context; main context only
+static uint64_t writes_sent;        // conf writes sent by IFACE_CTX; IFACE_CTX only
+static int sync_timer = -1;
+
+MODULE("RELAY");
+
+static void init(void) {
+    /* Forward any topic except REQUESTS */
+    m_subscribe("^[^Req].*");
+    m_register_fd(fds[0], false, NULL);
+    /* Only armed after INTERFACE requests: never wakes us up while idle */
+    sync_timer = timer_new(self(), "relay-sync", 0, 0);
+    timer_set_essential(sync_timer, true);
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return fds[0] != -1;
+}
+
+static void destroy(void) {
+    timer_free(sync_timer);
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case FD_UPD:
+        receive_frames(msg->fd_msg->fd);
+        break;
+    case SYSTEM_UPD:
+        break;
+    case TIMER_UPD:
+        /* Modules reacted to latest requests, possibly changing conf */
+        share_conf(false);
+        break;
+    default: {
+        /* Publishers already updated state and conf: let INTERFACE see them */
+        pthread_mutex_lock(&shared_mtx);
+        memcpy(&shared_state, &state, sizeof(state_t));
+        memcpy(&shared_conf, &conf, sizeof(conf_t));
+        writes_applied = writes_received;
+        pthread_mutex_unlock(&shared_mtx);
+        relay_frame_t f = { RELAY_MSG };
+        memcpy(&f.msg, msg->ps_msg->message, sizeof(message_t));
+        if (send_frame(fds[0], &f) == -1) {
+            stats_count("relay:updates_dropped");
+        }
+        break;
+    }
+    }
+}
+
+static void receive_frames(int fd) {
+    relay_frame_t f;
+    ssize_t len;
+    bool conf_written = false, published = false;
+    while ((len = recv(fd, &f, sizeof(f), MSG_DONTWAIT)) > 0) {
+        if ((size_t)len != frame_len(&f)) {
+            continue;
+        }
+        switch (f.op) {
+        case RELAY_MSG:
+            publish_request(&f);
+            published = true;
+            break;
+        case RELAY_CONF:
+            write_conf(&f);
+            writes_received++;
+            conf_written = true;
+            break;
+        case RELAY_CALL:
+            run_call(&f);
+            break;
+        default:
+            break;
+        }
+    }
+    if (conf_written) {
+        /* INTERFACE skips refreshes until its writes are applied: always let it know */
+        share_conf(true);
+    }
+    if (published) {
+        timer_set(sync_timer, 0, CONF_SYNC_MS * 1000 * 1000);
+    }
+}
+
+/* Points, if any, are stored right after the request, in the same autofreed block */
+static void publish_request(const relay_frame_t *f) {
+    if (f->msg.type < LOC_UPD || f->msg.type >= MSGS_SIZE) {
+        return;
+    }
+    const size_t points_len = frame_len(f) - offsetof(relay_frame_t, points);
+    message_t *req = malloc(sizeof(message_t) + points_len);
+    if (req) {
+        memcpy(req, &f->msg, sizeof(message_t));
+        if (req->type == CURVE_REQ && points_len > 0) {
+            req->curve.regression_points = (double *)(req + 1);
+            memcpy(req->curve.regression_points, f->points, points_len);
+        }
+        stats_publish(req->type);
+        m_publish(topics[req->type], req, sizeof(message_t) + points_len, true);
+    }
+}
+
+static void run_call(relay_frame_t *f) {
+    switch (f->call.call) {
+    case RELAY_LOAD:
+        f->call.ret = m_load(f->call.arg) == MOD_OK ? 0 : -EINVAL;
+        break;
+    case RELAY_UNLOAD:
+        f->call.ret = m_unload(f->call.arg) == MOD_OK ? 0 : -EINVAL;
+        break;
+    case RELAY_STORE_CONF:
+        f->call.ret = store_config(LOCAL) == 0 ? 0 : -EIO;
+        break;
+    default:
+        f->call.ret = -EOPNOTSUPP;
+        break;
+    }
+    /* INTERFACE is waiting for the result to reply its caller */
+    if (send_frame(fds[0], f) == -1) {
+        WARN("Failed to send call result: %s.\n", strerror(errno));
+    }
+}
+
+/* Write conf field from main context, where modules read it. Returns true if it was written */
+static bool write_conf(const relay_frame_t *f) {
+    if (f->conf_set.len == 0 || f->conf_set.offset + f->conf_set.len > sizeof(conf_t)) {
+        return false;
+    }
+    memcpy((uint8_t *)&conf + f->conf_set.offset, f->conf_set.data, f->conf_set.len);
+    return true;
+}
+
+/* Refresh conf copy, notifying INTERFACE if it changed (or anyway, if notify is true) */
+static void share_conf(bool notify) {
+    pthread_mutex_lock(&shared_mtx);
+    const bool changed = memcmp(&shared_conf, &conf, sizeof(conf_t)) != 0;
+    if (changed) {
+        memcpy(&shared_conf, &conf, sizeof(conf_t));
+    }
+    writes_applied = writes_received;
+    pthread_mutex_unlock(&shared_mtx);
+    
+    const relay_frame_t f = { RELAY_CONF };
+    if ((changed || notify) && send_frame(fds[0], &f) == -1) {
+        stats_count("relay:updates_dropped");
+    }
+}
+
+/* Bytes actually used by a frame; 0 if it is malformed */
+static size_t frame_len(const relay_frame_t *f) {
+    switch (f->op) {
+    case RELAY_MSG:
+        if (f->msg.type == CURVE_REQ && f->msg.curve.regression_points) {
+            if (f->msg.curve.num_points < 0 || f->msg.curve.num_points > MAX_SIZE_POINTS) {
+                return 0;
+            }
+            return offsetof(relay_frame_t, points) + f->msg.curve.num_points * sizeof(double);
+        }
+        return offsetof(relay_frame_t, points);
+    case RELAY_CONF:
+        if (f->conf_set.len > sizeof(f->conf_set.data)) {
+            return 0;
+        }
+        return offsetof(relay_frame_t, conf_set.data) + f->conf_set.len;
+    case RELAY_CALL:
+        return offsetof(relay_frame_t, call.arg) + strnlen(f->call.arg, PATH_MAX) + 1;
+    default:
+        return 0;
+    }
+}
+
+static int send_frame(int fd, const relay_frame_t *f) {
+    const size_t len = frame_len(f);
+    return -(send(fd, f, len, MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t)len);
+}
+
+static void *iface_loop(UNUSED void *data) {
+    modules_ctx_loop(IFACE_CTX);
+    return NULL;
+}
+
+/*
+ * Start IFACE_CTX thread; to be called by main thread before looping.
+ * Signals stay blocked in the new thread: SIGNAL module manages them on main thread.
+ */
+int relay_start(void) {
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) == -1) {
+        return -1;
+    }
+    memcpy(&shared_state, &state, sizeof(state_t));
+    memcpy(&shared_conf, &conf, sizeof(conf_t));
+
+    sigset_t mask, old;
+    sigfillset(&mask);
+    sigdelset(&mask, SIGSEGV);
+    pthread_sigmask(SIG_BLOCK, &mask, &old);
+    const int r = pthread_create(&iface_thread, NULL, iface_loop, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (r != 0) {
+        close(fds[0]);
+        close(fds[1]);
+        fds[0] = fds[1] = -1;
+        errno = r;
+        return -1;
+    }
+    return 0;
+}
+
+/* Shutting down our end makes INTERFACE leave its loop */
+void relay_stop(void) {
+    if (fds[0] != -1) {
+        shutdown(fds[0], SHUT_RDWR);
+        pthread_join(iface_thread, NULL);
+        close(fds[0]);
+        close(fds[1]);
+        fds[0] = fds[1] = -1;
+    }
+}
+
+/* Fd to be registered by INTERFACE to receive forwarded updates */
+int relay_get_fd(void) {
+    return fds[1];
+}
+
+/*
+ * Receive next frame sent by main context, from IFACE_CTX.
+ * Returns 1 if a frame was received, 0 if none is pending, -1 if main context is gone.
+ */
+int relay_recv(relay_frame_t *f) {
+    ssize_t len;
+    while ((len = recv(fds[1], f, sizeof(relay_frame_t), MSG_DONTWAIT)) > 0) {
+        if ((size_t)len == frame_len(f)) {
+            return 1;
+        }
+    }
+    return len == 0 ? -1 : 0;
+}
+
+/* Copy state as it was when latest update was forwarded */
+void relay_get_state(state_t *st) {
+    pthread_mutex_lock(&shared_mtx);
+    memcpy(st, &shared_state, sizeof(state_t));
+    pthread_mutex_unlock(&shared_mtx);
+}
+
+/*
+ * Copy conf as it was when latest update or conf notification was sent, from IFACE_CTX.
+ * Nothing is copied while any conf write sent through relay_set_conf() is still to be applied:
+ * c already holds it, while the copy does not. Returns false then.
+ */
+bool relay_get_conf(conf_t *c) {
+    pthread_mutex_lock(&shared_mtx);
+    const bool synced = writes_applied == writes_sent;
+    if (synced) {
+        memcpy(c, &shared_conf, sizeof(conf_t));
+    }
+    pthread_mutex_unlock(&shared_mtx);
+    return synced;
+}
+
+/*
+ * Publish a request on main context, from IFACE_CTX. Returns -1 if it could not be sent.
+ * Data pointed by the request (ie: CURVE_REQ points) is copied too:
+ * caller is free to release it as soon as this returns.
+ */
+int relay_publish(const message_t *msg) {
+    relay_frame_t f = { RELAY_MSG };
+    memcpy(&f.msg, msg, sizeof(message_t));
+    if (msg->type == CURVE_REQ && msg->curve.regression_points) {
+        if (msg->curve.num_points < 0 || msg->curve.num_points > MAX_SIZE_POINTS) {
+            return -1;
+        }
+        memcpy(f.points, msg->curve.regression_points, msg->curve.num_points * sizeof(double));
+        /* Only tells main context that points follow */
+        f.msg.curve.regression_points = f.points;
+    }
+    if (send_frame(fds[1], &f) == -1) {
+        WARN("Failed to forward %s request: %s.\n", topics[msg->type], strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Write len bytes of data at offset in conf, from IFACE_CTX.
+ * Caller is expected to write its copy too: it is only refreshed again
+ * once main context applied the write. Returns -1 if it could not be sent.
+ */
+int relay_set_conf(size_t offset, const void *data, size_t len) {
+    relay_frame_t f = { RELAY_CONF };
+    if (len == 0 || len > sizeof(f.conf_set.data) || offset + len > sizeof(conf_t)) {
+        return -1;
+    }
+    f.conf_set.offset = offset;
+    f.conf_set.len = len;
+    memcpy(f.conf_set.data, data, len);
+    if (send_frame(fds[1], &f) == -1) {
+        WARN("Failed to forward conf change: %s.\n", strerror(errno));
+        return -1;
+    }
+    writes_sent++;
+    return 0;
+}
+
+/*
+ * Run call on main context, from IFACE_CTX: its result is received back
+ * through relay_recv(), together with cookie.
+ * Returns -1 if it could not be sent.
+ */
+int relay_call(enum relay_calls call, const char *arg, void *cookie) {
+    relay_frame_t f = { RELAY_CALL };
+    f.call.call = call;
+    f.call.cookie = cookie;
+    strncpy(f.call.arg, arg, PATH_MAX);
+    if (send_frame(fds[1], &f) == -1) {
+        WARN("Failed to forward call: %s.\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "commons.h"
+
+#define IFACE_CTX "interface"       // libmodule context INTERFACE runs on, in its own thread
+
+/* Calls run on main context on behalf of INTERFACE, as libmodule is not thread safe */
+enum relay_calls { RELAY_LOAD, RELAY_UNLOAD, RELAY_STORE_CONF };
+
+enum relay_ops {
+    RELAY_MSG,                      // update (to IFACE_CTX) or request (to main context)
+    RELAY_CONF,                     // conf field write (to main context) or conf changed notification (to IFACE_CTX)
+    RELAY_CALL                      // call (to main context) or its result (to IFACE_CTX)
+};
+
+/* Frame exchanged between main context and IFACE_CTX; only used bytes are sent */
+typedef struct {
+    enum relay_ops op;
+    union {
+        struct {
+            message_t msg;
+            double points[MAX_SIZE_POINTS];     // CURVE_REQ regression points, sent by value
+        };
+        struct {
+            size_t offset;          // conf_t field offset
+            size_t len;             // 0 for notifications
+            uint8_t data[PATH_MAX + 1];
+        } conf_set;
+        struct {
+            enum relay_calls call;
+            int ret;                // call result: 0 or -errno
+            void *cookie;           // opaque for main context, eg: the method call to be replied
+            char arg[PATH_MAX + 1];
+        } call;
+    };
+} relay_frame_t;
+
+int relay_start(void);
+void relay_stop(void);
+int relay_get_fd(void);
+int relay_recv(relay_frame_t *f);
+void relay_get_state(state_t *st);
+bool relay_get_conf(conf_t *c);
+int relay_publish(const message_t *msg);
+int relay_set_conf(size_t offset, const void *data, size_t len);
+int relay_call(enum relay_calls call, const char *arg, void *cookie);
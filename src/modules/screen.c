@@ -1,19 +1,29 @@
 #include "bus.h"
-#include "my_math.h"
+
+#define SCREEN_STATIC_STDDEV    0.01    // below this standard deviation, screen content is considered static
+#define SCREEN_MIN_DELTA        0.02    // a sample farther than this (and 3 stddev) from average means screen content is changing
 
 enum screen_pause { UNPAUSED = 0, DISPLAY = 0x01, SENSOR = 0x02, LID = 0x04, CONTRIB = 0x08 };
 
 static void receive_waiting_acstate(const msg_t *msg, UNUSED const void *userdata);
 static int parse_bus_reply(sd_bus_message *reply, const char *member, void *userdata);
 static void get_screen_brightness(bool compute);
+static void add_sample(double br);
+static double get_average(void);
+static void adapt_interval(double br, double old_avg);
+static void reset_samples(void);
 static void receive_computing(const msg_t *msg, const void *userdata);
-static void timeout_callback(int old_val, bool is_computing);
+static void timeout_callback(bool is_computing);
 static void pause_screen(bool pause, enum screen_pause type);
 
 MODULE("SCREEN");
 
 static double *screen_br;
-static int screen_ctr, screen_fd = -1;
+static int screen_ctr, screen_timer = -1;
+static double screen_sum, screen_sumsq;         // running sum (and sum of squares) of screen_br samples
+static double screen_ema;                       // time-weighted moving average, used when conf.screen_conf.decay > 0
+static struct timespec last_sample;
+static int cur_timeout;                         // current (adaptive) sampling interval
 static int paused_state;
 
 DECLARE_MSG(screen_msg, SCR_BL_UPD);
@@ -48,17 +58,20 @@ static bool evaluate(void) {
 
 static void destroy(void) {
     free(screen_br);
-    if (screen_fd >= 0) {
-        close(screen_fd);
-    }
+    timer_free(screen_timer);
 }
 
 static void receive_waiting_acstate(const msg_t *msg, UNUSED const void *userdata) {
     switch (MSG_TYPE()) {
     case UPOWER_UPD: {
-        /* Start paused if screen timeout for current ac state is <= 0 */
-        screen_fd = start_timer(CLOCK_BOOTTIME, 0, conf.screen_conf.timeout[state.ac_state] > 0);
-        m_register_fd(screen_fd, false, NULL);
+        cur_timeout = conf.screen_conf.timeout[state.ac_state];
+        if (!conf.screen_conf.sync_capture) {
+            /* Start paused if screen timeout for current ac state is <= 0 */
+            screen_timer = timer_new(self(), "screen", 0, cur_timeout > 0);
+        } else {
+            /* BACKLIGHT samples screen-emitted brightness on each capture: no periodic timer needed */
+            DEBUG("Screen-emitted brightness sampled on each capture.\n");
+        }
         m_unbecome();
         break;
     }
@@ -69,15 +82,12 @@ static void receive_waiting_acstate(const msg_t *msg, UNUSED const void *userdat
 
 static void receive(const msg_t *msg, UNUSED const void *userdata) {
     switch (MSG_TYPE()) {
-    case FD_UPD:
-        read_timer(msg->fd_msg->fd);
+    case TIMER_UPD:
         get_screen_brightness(false);
         break;
-    case UPOWER_UPD: {
-        upower_upd *up = (upower_upd *)MSG_DATA();
-        timeout_callback(conf.screen_conf.timeout[up->old], false);
+    case UPOWER_UPD:
+        timeout_callback(false);
         break;
-    }
     case DISPLAY_UPD:
         pause_screen(state.display_state, DISPLAY);
         break;
@@ -92,10 +102,9 @@ static void receive(const msg_t *msg, UNUSED const void *userdata) {
     case SCR_TO_REQ: {
         timeout_upd *up = (timeout_upd *)MSG_DATA();
         if (VALIDATE_REQ(up)) {
-            const int old = conf.screen_conf.timeout[up->state];
             conf.screen_conf.timeout[up->state] = up->new;
             if (up->state == state.ac_state) {
-                timeout_callback(old, false);
+                timeout_callback(false);
             }
         }
         break;
@@ -114,15 +123,12 @@ static void receive(const msg_t *msg, UNUSED const void *userdata) {
 
 static void receive_computing(const msg_t *msg, UNUSED const void *userdata) {
     switch (MSG_TYPE()) {
-    case FD_UPD:
-        read_timer(msg->fd_msg->fd);
+    case TIMER_UPD:
         get_screen_brightness(true);
         break;
-    case UPOWER_UPD: {
-        upower_upd *up = (upower_upd *)MSG_DATA();
-        timeout_callback(conf.screen_conf.timeout[up->old], true);
-        break;  
-    }
+    case UPOWER_UPD:
+        timeout_callback(true);
+        break;
     case DISPLAY_UPD:
         pause_screen(state.display_state, DISPLAY);
         break;
@@ -137,10 +143,9 @@ static void receive_computing(const msg_t *msg, UNUSED const void *userdata) {
     case SCR_TO_REQ: {
         timeout_upd *up = (timeout_upd *)MSG_DATA();
         if (VALIDATE_REQ(up)) {
-            const int old = conf.screen_conf.timeout[up->state];
             conf.screen_conf.timeout[up->state] = up->new;
             if (up->state == state.ac_state) {
-                timeout_callback(old, true);
+                timeout_callback(true);
             }
         }
         break;
@@ -152,7 +157,7 @@ static void receive_computing(const msg_t *msg, UNUSED const void *userdata) {
             conf.screen_conf.contrib = up->new;
             /* Recompute current screen compensation */
             screen_msg.bl.old = state.screen_comp;
-            state.screen_comp = compute_average(screen_br, conf.screen_conf.samples) * conf.screen_conf.contrib;
+            state.screen_comp = get_average() * conf.screen_conf.contrib;
             if (screen_msg.bl.old != state.screen_comp) {
                 screen_msg.bl.new = state.screen_comp;
                 M_PUB(&screen_msg);
@@ -172,46 +177,123 @@ static void receive_computing(const msg_t *msg, UNUSED const void *userdata) {
 static int parse_bus_reply(sd_bus_message *reply, const char *member, void *userdata) {
     int r = -EINVAL;
     if (!strcmp(member, "GetEmittedBrightness")) {
-        r = sd_bus_message_read(reply, "d", &screen_br[screen_ctr]);
+        r = sd_bus_message_read(reply, "d", userdata);
     }
     return r;
 }
 
 static void get_screen_brightness(bool compute) {
-    SYSBUS_ARG_REPLY(args, parse_bus_reply, NULL, CLIGHTD_SERVICE, "/org/clightd/clightd/Screen", "org.clightd.clightd.Screen", "GetEmittedBrightness");
+    double br;
+    SYSBUS_ARG_REPLY(args, parse_bus_reply, &br, CLIGHTD_SERVICE, "/org/clightd/clightd/Screen", "org.clightd.clightd.Screen", "GetEmittedBrightness");
     
     if (call(&args, "ss", state.display, state.xauthority) == 0) {
-        screen_ctr = (screen_ctr + 1) % conf.screen_conf.samples;
+        const double old_avg = screen_sum / conf.screen_conf.samples;
+        add_sample(br);
         
         if (compute) {
             screen_msg.bl.old = state.screen_comp;
-            state.screen_comp = compute_average(screen_br, conf.screen_conf.samples) * conf.screen_conf.contrib;
+            state.screen_comp = get_average() * conf.screen_conf.contrib;
             if (screen_msg.bl.old != state.screen_comp) {
                 screen_msg.bl.new = state.screen_comp;
                 M_PUB(&screen_msg);
             }
             DEBUG("Average screen-emitted brightness: %lf.\n", state.screen_comp);
-        } else if (screen_ctr + 1 == conf.screen_conf.samples) {
+            adapt_interval(br, old_avg);
+        } else if (screen_ctr == 0) {
             /* Bucket filled! Start computing! */
             DEBUG("Start compensating for screen-emitted brightness.\n");
             m_become(computing);
         }
     }
-    set_timeout(conf.screen_conf.timeout[state.ac_state], 0, screen_fd, 0);
+    timer_set(screen_timer, cur_timeout, 0);
+}
+
+/*
+ * Store a new sample in screen_br ring, keeping running sums up to date in O(1).
+ * Sums are recomputed from scratch once per ring loop, 
+ * to avoid accumulating floating point errors.
+ */
+static void add_sample(double br) {
+    const double old = screen_br[screen_ctr];
+    screen_br[screen_ctr] = br;
+    screen_ctr = (screen_ctr + 1) % conf.screen_conf.samples;
+    if (screen_ctr == 0) {
+        screen_sum = screen_sumsq = 0.0;
+        for (int i = 0; i < conf.screen_conf.samples; i++) {
+            screen_sum += screen_br[i];
+            screen_sumsq += screen_br[i] * screen_br[i];
+        }
+    } else {
+        screen_sum += br - old;
+        screen_sumsq += br * br - old * old;
+    }
+    
+    /* 
+     * As sampling interval is not constant (and we may be paused for a long time),
+     * weight new sample by the time elapsed since last one.
+     */
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    if (conf.screen_conf.decay > 0) {
+        if (last_sample.tv_sec == 0) {
+            screen_ema = br;
+        } else {
+            const double dt = (now.tv_sec - last_sample.tv_sec) + (now.tv_nsec - last_sample.tv_nsec) / 1e9;
+            screen_ema += (1.0 - exp(-dt / conf.screen_conf.decay)) * (br - screen_ema);
+        }
+    }
+    last_sample = now;
+}
+
+static double get_average(void) {
+    if (conf.screen_conf.decay > 0) {
+        return screen_ema;
+    }
+    return screen_sum / conf.screen_conf.samples;
+}
+
+/*
+ * Back off sampling interval (up to conf.screen_conf.max_backoff times the configured timeout)
+ * while screen content is static, ie: samples variance is low;
+ * go back to configured timeout as soon as a sample moves away from the average.
+ */
+static void adapt_interval(double br, double old_avg) {
+    const int timeout = conf.screen_conf.timeout[state.ac_state];
+    const double mean = screen_sum / conf.screen_conf.samples;
+    const double variance = screen_sumsq / conf.screen_conf.samples - mean * mean;
+    const double stddev = variance > 0 ? sqrt(variance) : 0.0;
+    
+    const int old_timeout = cur_timeout;
+    if (fabs(br - old_avg) > fmax(3 * stddev, SCREEN_MIN_DELTA)) {
+        cur_timeout = timeout;
+    } else if (stddev < SCREEN_STATIC_STDDEV && cur_timeout < timeout * conf.screen_conf.max_backoff) {
+        cur_timeout = fmin(cur_timeout * 2, timeout * conf.screen_conf.max_backoff);
+    }
+    if (old_timeout != cur_timeout) {
+        DEBUG("Screen sampling interval: %ds.\n", cur_timeout);
+    }
+}
+
+static void reset_samples(void) {
+    memset(screen_br, 0, conf.screen_conf.samples * sizeof(double));
+    screen_ctr = 0;
+    screen_sum = screen_sumsq = screen_ema = 0.0;
+    memset(&last_sample, 0, sizeof(last_sample));
 }
 
-static void timeout_callback(int old_val, bool is_computing) {
-    reset_timer(screen_fd, old_val, conf.screen_conf.timeout[state.ac_state]);
+static void timeout_callback(bool is_computing) {
+    const int old_timeout = cur_timeout;
+    cur_timeout = conf.screen_conf.timeout[state.ac_state];
+    timer_reset(screen_timer, old_timeout, cur_timeout);
     /* 
      * A paused timeout has been set; this means user does not want 
      * SCREEN to work in current AC state.
      * Avoid keeping alive old state.screen_comp that won't be never updated,
      * and reset all screen_br values.
      */
-    if (conf.screen_conf.timeout[state.ac_state] <= 0) {
+    if (cur_timeout <= 0) {
         state.screen_comp = 0.0;
-        memset(screen_br, 0, conf.screen_conf.samples * sizeof(double));
-        screen_ctr = 0;
+        reset_samples();
         
         if (is_computing) {
             m_unbecome();
@@ -223,14 +305,14 @@ static void pause_screen(bool pause, enum screen_pause type) {
     if (pause) {
         if (paused_state == UNPAUSED) {
             /* Stop capturing snapshots */
-            m_deregister_fd(screen_fd);
+            timer_pause(screen_timer, true);
         }
         paused_state |= type;
     } else {
         paused_state &= ~type;
         if (paused_state == UNPAUSED) {
             /* Resume capturing */
-            m_register_fd(screen_fd, false, NULL);
+            timer_pause(screen_timer, false);
         }
     }
 }
@@ -1,11 +1,12 @@
 #include <sys/signalfd.h>
 #include <signal.h>
-#include "commons.h"
+#include "stats.h"
 
 MODULE("SIGNAL");
 
 /*
- * Set signals handler for SIGINT and SIGTERM (using a signalfd)
+ * Set signals handler for SIGINT and SIGTERM (using a signalfd);
+ * SIGUSR1 dumps stats to log file.
  */
 static void init(void) {
     sigset_t mask;
@@ -13,6 +14,7 @@ static void init(void) {
     sigemptyset(&mask);
     sigaddset(&mask, SIGINT);
     sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1);
     sigprocmask(SIG_BLOCK, &mask, NULL);
 
     int fd = signalfd(-1, &mask, 0);
@@ -35,6 +37,7 @@ static void destroy(void) {
 /*
  * if received an external SIGINT or SIGTERM,
  * just switch the quit flag to 1 and print to stdout.
+ * On SIGUSR1, dump current stats to log file and keep going.
  */
 static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     switch (MSG_TYPE()) {
@@ -46,8 +49,16 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
         if (s != sizeof(struct signalfd_siginfo)) {
             ERROR("An error occurred while getting signalfd data.\n");
         }
-        INFO("Received %d. Leaving.\n", fdsi.ssi_signo);
-        modules_quit(EXIT_SUCCESS);
+        char source[32];
+        snprintf(source, sizeof(source), "signal:%d", fdsi.ssi_signo);
+        stats_wakeup(source);
+        if (fdsi.ssi_signo == SIGUSR1) {
+            INFO("Received %d. Dumping stats.\n", fdsi.ssi_signo);
+            log_stats();
+        } else {
+            INFO("Received %d. Leaving.\n", fdsi.ssi_signo);
+            modules_quit(EXIT_SUCCESS);
+        }
         break;
     }
     default:
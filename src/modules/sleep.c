@@ -0,0 +1,184 @@
+#include <fcntl.h>
+#include "bus.h"
+
+#define ACK_TIMEOUT_MS 2000     // go on anyway if any module did not acknowledge latest SUSPEND_UPD meanwhile
+
+/* Modules whose acknowledgement we wait for, before sleep (BACKLIGHT, GAMMA) or on resume (DAYTIME) */
+enum sleep_acks { BACKLIGHT_ACK = 0x01, GAMMA_ACK = 0x02, DAYTIME_ACK = 0x04 };
+
+static int parse_bus_reply(sd_bus_message *reply, const char *member, void *userdata);
+static int take_inhibitor(void);
+static void release_inhibitor(void);
+static int on_prepare_for_sleep(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int expect_ack(const self_t *ref, enum sleep_acks ack);
+static void on_ack(const self_t *sender, const suspend_upd *up);
+static void on_acked(void);
+
+static int inhibit_fd = -1;
+static int ack_timer = -1;
+static int pending_acks;        // enum sleep_acks bitmask of acknowledgements still missing for latest SUSPEND_UPD
+static sd_bus_slot *slot;
+static const self_t *backlight_ref, *gamma_ref, *daytime_ref;
+
+DECLARE_MSG(suspend_msg, SUSPEND_UPD);
+DECLARE_MSG(capture_req, CAPTURE_REQ);
+
+MODULE("SLEEP");
+
+static void init(void) {
+    M_SUB(SUSPEND_ACK_REQ);
+    m_ref("BACKLIGHT", &backlight_ref);
+    m_ref("GAMMA", &gamma_ref);
+    m_ref("DAYTIME", &daytime_ref);
+    
+    capture_req.capture.reset_timer = true;
+    capture_req.capture.capture_only = false;
+    
+    /* Must fire while suspending, when any non essential timer is held */
+    ack_timer = timer_new(self(), "sleep-ack", 0, 0);
+    timer_set_essential(ack_timer, true);
+    
+    SYSBUS_ARG(args, "org.freedesktop.login1", "/org/freedesktop/login1", "org.freedesktop.login1.Manager", "PrepareForSleep");
+    if (add_match(&args, &slot, on_prepare_for_sleep) != 0) {
+        WARN("Failed to watch logind sleep signals.\n");
+        m_poisonpill(self());
+    } else if (take_inhibitor() != 0) {
+        /* We can still notify suspend/resume; we just won't delay sleep */
+        WARN("Failed to take logind sleep delay inhibitor.\n");
+    }
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return !conf.wizard;
+}
+
+static void destroy(void) {
+    if (slot) {
+        slot = sd_bus_slot_unref(slot);
+    }
+    release_inhibitor();
+    timer_free(ack_timer);
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case SUSPEND_ACK_REQ: {
+        suspend_upd *up = (suspend_upd *)MSG_DATA();
+        on_ack(msg->ps_msg->sender, up);
+        break;
+    }
+    case TIMER_UPD:
+        if (pending_acks) {
+            WARN("Modules did not acknowledge %s in %dms.\n", state.suspended ? "suspension" : "resume", ACK_TIMEOUT_MS);
+            pending_acks = 0;
+            on_acked();
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static int parse_bus_reply(sd_bus_message *reply, const char *member, void *userdata) {
+    int fd;
+    int r = sd_bus_message_read(reply, "h", &fd);
+    if (r >= 0) {
+        /* Returned fd is owned by the reply message */
+        *(int *)userdata = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+        if (*(int *)userdata == -1) {
+            r = -errno;
+        }
+    }
+    return r;
+}
+
+/*
+ * Take a logind "delay" sleep inhibitor: logind will wait for us
+ * to release it before actually suspending (up to InhibitDelayMaxUSec).
+ */
+static int take_inhibitor(void) {
+    if (inhibit_fd != -1) {
+        return 0;
+    }
+    SYSBUS_ARG_REPLY(args, parse_bus_reply, &inhibit_fd, "org.freedesktop.login1", "/org/freedesktop/login1", "org.freedesktop.login1.Manager", "Inhibit");
+    int r = call(&args, "ssss", "sleep", "Clight", "Pause timers and transitions before sleep.", "delay");
+    if (r == 0) {
+        DEBUG("Holding sleep delay inhibitor.\n");
+    }
+    return r;
+}
+
+static void release_inhibitor(void) {
+    if (inhibit_fd != -1) {
+        close(inhibit_fd);
+        inhibit_fd = -1;
+        DEBUG("Released sleep delay inhibitor.\n");
+    }
+}
+
+/*
+ * PrepareForSleep(true) is sent right before suspending, PrepareForSleep(false) on resume.
+ * Publish SUSPEND_UPD so that modules can freeze before sleep,
+ * and refresh themselves once on resume, instead of each of them
+ * reacting on its own to expired timers and clock changes.
+ */
+static int on_prepare_for_sleep(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
+    int going_to_sleep;
+    int r = sd_bus_message_read(m, "b", &going_to_sleep);
+    if (r >= 0 && going_to_sleep != state.suspended) {
+        INFO("%s.\n", going_to_sleep ? "Going to sleep" : "Resumed from sleep");
+        suspend_msg.suspend.old = state.suspended;
+        state.suspended = going_to_sleep;
+        suspend_msg.suspend.new = state.suspended;
+        M_PUB(&suspend_msg);
+        if (state.suspended) {
+            /* Let logind proceed once BACKLIGHT and GAMMA stopped any transition */
+            pending_acks = expect_ack(backlight_ref, BACKLIGHT_ACK) | expect_ack(gamma_ref, GAMMA_ACK);
+        } else {
+            /* Be ready for next suspension */
+            take_inhibitor();
+            /* Single ordered refresh: capture once DAYTIME recomputed daytime (and GAMMA followed) */
+            pending_acks = expect_ack(daytime_ref, DAYTIME_ACK);
+        }
+        timer_set(ack_timer, 0, pending_acks ? ACK_TIMEOUT_MS * 1000 * 1000 : 0);
+        if (!pending_acks) {
+            on_acked();
+        }
+    }
+    return 0;
+}
+
+static int expect_ack(const self_t *ref, enum sleep_acks ack) {
+    return ref && module_is(ref, RUNNING) ? ack : 0;
+}
+
+/* Acks for a superseded SUSPEND_UPD are ignored */
+static void on_ack(const self_t *sender, const suspend_upd *up) {
+    if (!pending_acks || up->new != state.suspended) {
+        return;
+    }
+    if (sender == backlight_ref) {
+        pending_acks &= ~BACKLIGHT_ACK;
+    } else if (sender == gamma_ref) {
+        pending_acks &= ~GAMMA_ACK;
+    } else if (sender == daytime_ref) {
+        pending_acks &= ~DAYTIME_ACK;
+    }
+    if (!pending_acks) {
+        timer_set(ack_timer, 0, 0);
+        on_acked();
+    }
+}
+
+/* Every module we were waiting for handled latest SUSPEND_UPD */
+static void on_acked(void) {
+    if (state.suspended) {
+        release_inhibitor();
+    } else {
+        M_PUB(&capture_req);
+    }
+}
@@ -0,0 +1,102 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "snapshot.h"
+#include "commons.h"
+
+static void update_snapshot(void);
+
+static clight_snapshot_t *snap;
+static char snap_file[PATH_MAX + 1];
+
+MODULE("SNAPSHOT");
+
+static void init(void) {
+    snprintf(snap_file, PATH_MAX, "%s/%s", getenv("XDG_RUNTIME_DIR"), CLIGHT_SNAPSHOT_FILE);
+    
+    int fd = open(snap_file, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd != -1) {
+        if (ftruncate(fd, sizeof(clight_snapshot_t)) == 0) {
+            void *ptr = mmap(NULL, sizeof(clight_snapshot_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (ptr != MAP_FAILED) {
+                snap = ptr;
+            }
+        }
+        close(fd);
+    }
+    
+    if (snap) {
+        snap->magic = CLIGHT_SNAPSHOT_MAGIC;
+        snap->version = CLIGHT_SNAPSHOT_VERSION;
+        update_snapshot();
+        /* Subscribe to any topic expept REQUESTS */
+        m_subscribe("^[^Req].*");
+    } else {
+        WARN("Failed to map %s: %s.\n", snap_file, strerror(errno));
+        m_poisonpill(self());
+    }
+}
+
+static bool check(void) {
+    return getenv("XDG_RUNTIME_DIR") != NULL;
+}
+
+static bool evaluate(void) {
+    return !conf.wizard;
+}
+
+static void destroy(void) {
+    if (snap) {
+        /* Let readers know snapshot will not be updated anymore */
+        __atomic_store_n(&snap->alive, 0, __ATOMIC_RELEASE);
+        munmap(snap, sizeof(clight_snapshot_t));
+        unlink(snap_file);
+    }
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case FD_UPD:
+    case SYSTEM_UPD:
+    case CAPTURE_UPD:
+        /* Capture results are published by their own _UPD messages too */
+        break;
+    default:
+        update_snapshot();
+        break;
+    }
+}
+
+/*
+ * Publishers update state before sending _UPD messages:
+ * just copy it over, as a whole, under seqlock.
+ */
+static void update_snapshot(void) {
+    const uint32_t seq = snap->seq;
+    __atomic_store_n(&snap->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    
+    snap->alive = 1;
+    snap->ac_state = state.ac_state;
+    snap->display_state = state.display_state;
+    snap->idle_state = state.idle_state;
+    snap->lid_state = state.lid_state;
+    snap->day_time = state.day_time;
+    snap->next_event = state.next_event;
+    snap->in_event = state.in_event;
+    snap->inhibited = state.inhibited;
+    snap->pm_inhibited = state.pm_inhibited;
+    snap->sens_avail = state.sens_avail;
+    snap->deep_idle = state.deep_idle;
+    snap->suspended = state.suspended;
+    snap->temp = state.current_temp;
+    snap->sunrise = state.day_events[SUNRISE];
+    snap->sunset = state.day_events[SUNSET];
+    snap->bl_pct = state.current_bl_pct;
+    snap->kbd_pct = state.current_kbd_pct;
+    snap->ambient_br = state.ambient_br;
+    snap->screen_comp = state.screen_comp;
+    snap->lat = state.current_loc.lat;
+    snap->lon = state.current_loc.lon;
+    
+    __atomic_store_n(&snap->seq, seq + 2, __ATOMIC_RELEASE);
+}
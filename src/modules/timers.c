@@ -0,0 +1,439 @@
+#include <sys/timerfd.h>
+#include "stats.h"
+
+#define MAX_TIMERS      32
+#define NSEC_PER_SEC    1000000000ULL
+#define NSEC_PER_MSEC   1000000ULL
+
+typedef struct {
+    const self_t *owner;        // module that will receive TIMER_UPD messages
+    char name[32];
+    uint64_t deadline;          // CLOCK_BOOTTIME deadline in ns; 0 if disarmed
+    uint64_t slack;             // how much (ns) expiration can be delayed to be coalesced with other timers
+    int heap_idx;               // position inside heap; -1 if not queued
+    bool in_use;
+    bool paused;
+    bool pending;               // whether timer expired while paused
+    bool essential;             // whether timer must keep running while in deep-idle
+    bool slept;                 // whether timer was held while suspended; its deadline is postponed on resume
+    message_t msg;
+} clight_timer_t;
+
+static uint64_t now_ns(void);
+static inline uint64_t hard_deadline(int id);
+static void heap_swap(int i, int j);
+static void heap_sift_up(int i);
+static void heap_sift_down(int i);
+static void heap_push(int id);
+static void heap_remove(int id);
+static void enqueue(int id);
+static void collect_expired(int i, uint64_t now, int *expired, int *num_expired);
+static void arm_timerfd(void);
+static void deliver(int id);
+static void on_timerfd(void);
+static inline bool is_valid(int id);
+static inline bool is_held(int id);
+static void update_held(void);
+static void mark_slept(void);
+static void postpone_slept(uint64_t postpone);
+
+static clight_timer_t timers[MAX_TIMERS];
+static int heap[MAX_TIMERS];    // min-heap of timer ids, ordered by hard deadline (ie: deadline + slack)
+static int heap_len;
+static uint64_t max_slack;      // greatest slack ever requested; used to prune heap walk on expiration
+static int timer_fd = -1;
+static uint64_t suspend_time;    // CLOCK_BOOTTIME time we went to sleep at
+
+DECLARE_MSG(timer_msg, TIMER_UPD);
+
+MODULE("TIMERS");
+
+static void module_pre_start(void) {
+    /* Create timerfd before any module is started, as modules may create timers in their init */
+    timer_fd = timerfd_create(CLOCK_BOOTTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+}
+
+static void init(void) {
+    if (timer_fd == -1) {
+        ERROR("TIMERS: Failed to create timerfd: %s\n", strerror(errno));
+    }
+    m_register_fd(timer_fd, false, NULL);
+    M_SUB(DEEP_IDLE_UPD);
+    M_SUB(SUSPEND_UPD);
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return true;
+}
+
+static void destroy(void) {
+    if (timer_fd >= 0) {
+        close(timer_fd);
+        timer_fd = -1;
+    }
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case FD_UPD:
+        on_timerfd();
+        break;
+    case DEEP_IDLE_UPD:
+        update_held();
+        break;
+    case SUSPEND_UPD: {
+        suspend_upd *up = (suspend_upd *)MSG_DATA();
+        if (up->new) {
+            suspend_time = now_ns();
+            mark_slept();
+            update_held();
+        } else {
+            /* 
+             * Do not fire every held timer on resume: modules refresh themselves once
+             * on SUSPEND_UPD, thus just postpone any deadline by the time spent sleeping,
+             * even for timers that are still held by deep-idle (eg: suspended by closing the lid).
+             */
+            postpone_slept(now_ns() - suspend_time);
+            update_held();
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static inline uint64_t hard_deadline(int id) {
+    return timers[id].deadline + timers[id].slack;
+}
+
+static void heap_swap(int i, int j) {
+    const int tmp = heap[i];
+    heap[i] = heap[j];
+    heap[j] = tmp;
+    timers[heap[i]].heap_idx = i;
+    timers[heap[j]].heap_idx = j;
+}
+
+static void heap_sift_up(int i) {
+    while (i > 0) {
+        const int parent = (i - 1) / 2;
+        if (hard_deadline(heap[parent]) <= hard_deadline(heap[i])) {
+            break;
+        }
+        heap_swap(i, parent);
+        i = parent;
+    }
+}
+
+static void heap_sift_down(int i) {
+    for (;;) {
+        const int l = 2 * i + 1;
+        const int r = l + 1;
+        int min = i;
+        if (l < heap_len && hard_deadline(heap[l]) < hard_deadline(heap[min])) {
+            min = l;
+        }
+        if (r < heap_len && hard_deadline(heap[r]) < hard_deadline(heap[min])) {
+            min = r;
+        }
+        if (min == i) {
+            break;
+        }
+        heap_swap(i, min);
+        i = min;
+    }
+}
+
+static void heap_push(int id) {
+    heap[heap_len] = id;
+    timers[id].heap_idx = heap_len++;
+    heap_sift_up(timers[id].heap_idx);
+}
+
+static void heap_remove(int id) {
+    const int i = timers[id].heap_idx;
+    if (i == -1) {
+        return;
+    }
+    timers[id].heap_idx = -1;
+    if (i != --heap_len) {
+        heap[i] = heap[heap_len];
+        timers[heap[i]].heap_idx = i;
+        heap_sift_down(i);
+        heap_sift_up(i);
+    }
+}
+
+/*
+ * Queue an armed timer; while in deep-idle or suspended, non-essential timers
+ * are kept out of the heap, so that they cannot wake us up.
+ */
+static void enqueue(int id) {
+    if (timers[id].deadline != 0 && !is_held(id)) {
+        heap_push(id);
+    }
+}
+
+/*
+ * Collect any timer whose soft deadline already passed.
+ * As the heap is ordered by hard deadline, no timer in a subtree
+ * whose root has hard deadline > now + max_slack can be expired:
+ * prune the walk there.
+ */
+static void collect_expired(int i, uint64_t now, int *expired, int *num_expired) {
+    if (i >= heap_len || hard_deadline(heap[i]) > now + max_slack) {
+        return;
+    }
+    if (timers[heap[i]].deadline <= now) {
+        expired[(*num_expired)++] = heap[i];
+    }
+    collect_expired(2 * i + 1, now, expired, num_expired);
+    collect_expired(2 * i + 2, now, expired, num_expired);
+}
+
+/* Arm timerfd on first hard deadline, or disarm it if no timer is queued */
+static void arm_timerfd(void) {
+    struct itimerspec timerValue = {{0}};
+
+    if (timer_fd == -1) {
+        return;
+    }
+    if (heap_len > 0) {
+        const uint64_t next = hard_deadline(heap[0]);
+        timerValue.it_value.tv_sec = next / NSEC_PER_SEC;
+        timerValue.it_value.tv_nsec = next % NSEC_PER_SEC;
+    }
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &timerValue, NULL) == -1) {
+        WARN("Failed to arm timerfd: %s\n", strerror(errno));
+    }
+}
+
+static void deliver(int id) {
+    if (timers[id].paused) {
+        /* Hold the expiration until the timer gets resumed */
+        timers[id].pending = true;
+    } else {
+        m_tell(timers[id].owner, &timers[id].msg, sizeof(message_t), false);
+    }
+}
+
+static void on_timerfd(void) {
+    uint64_t t;
+    read(timer_fd, &t, sizeof(uint64_t));
+
+    int expired[MAX_TIMERS];
+    int num_expired = 0;
+    const uint64_t now = now_ns();
+    collect_expired(0, now, expired, &num_expired);
+
+    /* Dequeue every expired timer before delivering, as owners may rearm them */
+    for (int i = 0; i < num_expired; i++) {
+        heap_remove(expired[i]);
+        timers[expired[i]].deadline = 0;
+    }
+    for (int i = 0; i < num_expired; i++) {
+        char source[64];
+        snprintf(source, sizeof(source), "timer:%s", timers[expired[i]].name);
+        stats_wakeup(source);
+        deliver(expired[i]);
+    }
+    arm_timerfd();
+}
+
+static inline bool is_valid(int id) {
+    return id >= 0 && id < MAX_TIMERS && timers[id].in_use;
+}
+
+static inline bool is_held(int id) {
+    return !timers[id].essential && (state.deep_idle || state.suspended);
+}
+
+/* Dequeue held timers, and requeue released ones */
+static void update_held(void) {
+    for (int id = 0; id < MAX_TIMERS; id++) {
+        if (timers[id].in_use && !timers[id].essential) {
+            if (is_held(id)) {
+                heap_remove(id);
+            } else if (timers[id].heap_idx == -1) {
+                /* Any timer expired while held will fire straight away, all in a single wakeup */
+                enqueue(id);
+            }
+        }
+    }
+    arm_timerfd();
+}
+
+/* Mark armed timers that are going to be held while suspended */
+static void mark_slept(void) {
+    for (int id = 0; id < MAX_TIMERS; id++) {
+        timers[id].slept = timers[id].in_use && !timers[id].essential && timers[id].deadline != 0;
+    }
+}
+
+/* Postpone deadline of timers that were held while suspended, and not set meanwhile, by "postpone" ns */
+static void postpone_slept(uint64_t postpone) {
+    for (int id = 0; id < MAX_TIMERS; id++) {
+        if (timers[id].slept) {
+            timers[id].slept = false;
+            if (timers[id].in_use && timers[id].deadline != 0) {
+                heap_remove(id);
+                timers[id].deadline += postpone;
+            }
+        }
+    }
+}
+
+/*
+ * Create a new timer owned by "owner" module, that will receive
+ * a TIMER_UPD message once it expires, and arm it in initial_s s and initial_ns ns.
+ * Returns timer id, or -1 on error.
+ */
+int timer_new(const self_t *owner, const char *name, int initial_s, int initial_ns) {
+    for (int id = 0; id < MAX_TIMERS; id++) {
+        if (!timers[id].in_use) {
+            clight_timer_t *t = &timers[id];
+            memset(t, 0, sizeof(clight_timer_t));
+            t->owner = owner;
+            strncpy(t->name, name, sizeof(t->name) - 1);
+            t->heap_idx = -1;
+            t->in_use = true;
+            memcpy(&t->msg, &timer_msg, sizeof(message_t));
+            t->msg.timer.id = id;
+            timer_set_slack(id, conf.timer_slack);
+            timer_set(id, initial_s, initial_ns);
+            return id;
+        }
+    }
+    WARN("Failed to create '%s' timer: too many timers.\n", name);
+    return -1;
+}
+
+/*
+ * Set a new trigger on timer in sec seconds and nsec nanoseconds.
+ * A 0s 0ns timeout disarms the timer.
+ */
+void timer_set(int id, int sec, int nsec) {
+    if (!is_valid(id)) {
+        return;
+    }
+
+    clight_timer_t *t = &timers[id];
+    if (sec < 0) {
+        sec = 0;
+    }
+    heap_remove(id);
+    t->pending = false;
+    t->slept = false;
+    if (sec != 0 || nsec != 0) {
+        t->deadline = now_ns() + (uint64_t)sec * NSEC_PER_SEC + nsec;
+        enqueue(id);
+        DEBUG("Set timeout of %ds %dns on '%s' timer.\n", sec, nsec, t->name);
+    } else {
+        t->deadline = 0;
+        DEBUG("Disarmed '%s' timer.\n", t->name);
+    }
+    arm_timerfd();
+}
+
+/*
+ * Switch timer from old_timer timeout to new_timer timeout,
+ * accounting for already elapsed time.
+ */
+void timer_reset(int id, int old_timer, int new_timer) {
+    if (!is_valid(id)) {
+        return;
+    }
+
+    if (old_timer < 0) {
+        old_timer = 0;
+    }
+    long remaining = 0;
+    if (timers[id].deadline != 0) {
+        const uint64_t now = now_ns();
+        if (timers[id].deadline > now) {
+            remaining = (timers[id].deadline - now) / NSEC_PER_SEC;
+        }
+    }
+    unsigned int elapsed_time = old_timer - remaining;
+    /* if we still need to wait some seconds */
+    if (new_timer > elapsed_time) {
+        timer_set(id, new_timer - elapsed_time, 0);
+    } else if (new_timer > 0) {
+        /* with new timeout, old_timeout would already been elapsed */
+        timer_set(id, 0, 1);
+    } else {
+        /* pause timer as a timeout <= 0 has been set */
+        timer_set(id, 0, 0);
+    }
+}
+
+/*
+ * Hold (or resume) timer expirations delivery.
+ * A paused timer keeps running; if it expires while paused,
+ * its expiration is delivered as soon as it gets resumed.
+ */
+void timer_pause(int id, bool pause) {
+    if (!is_valid(id)) {
+        return;
+    }
+
+    timers[id].paused = pause;
+    if (!pause && timers[id].pending) {
+        timers[id].pending = false;
+        deliver(id);
+    }
+}
+
+/*
+ * Allow timer expiration to be delayed up to slack_ms ms,
+ * to be coalesced with other timers into a single wakeup.
+ */
+void timer_set_slack(int id, int slack_ms) {
+    if (!is_valid(id)) {
+        return;
+    }
+
+    if (slack_ms < 0) {
+        slack_ms = 0;
+    }
+    heap_remove(id);
+    timers[id].slack = (uint64_t)slack_ms * NSEC_PER_MSEC;
+    if (timers[id].slack > max_slack) {
+        max_slack = timers[id].slack;
+    }
+    enqueue(id);
+    arm_timerfd();
+}
+
+/* Essential timers keep waking clight up even in deep-idle */
+void timer_set_essential(int id, bool essential) {
+    if (!is_valid(id)) {
+        return;
+    }
+
+    heap_remove(id);
+    timers[id].essential = essential;
+    enqueue(id);
+    arm_timerfd();
+}
+
+void timer_free(int id) {
+    if (!is_valid(id)) {
+        return;
+    }
+
+    heap_remove(id);
+    timers[id].in_use = false;
+    arm_timerfd();
+}
@@ -21,7 +21,7 @@
 
 #define DECLARE_MSG(name, type)     ASSERT_MSG(type); static message_t name = { type }
 
-#define M_PUB(ptr)                  m_publish(topics[(ptr)->type], ptr, sizeof(message_t), false);
+#define M_PUB(ptr)                  do { stats_publish((ptr)->type); m_publish(topics[(ptr)->type], ptr, sizeof(message_t), false); } while (0);
 #define M_SUB(type)                 ASSERT_MSG(type); m_subscribe(topics[type]);
 
 /** Log Macros **/
@@ -53,6 +53,9 @@ enum display_states { DISPLAY_ON, DISPLAY_DIMMED, DISPLAY_OFF, DISPLAY_SIZE };
 /* Dimming transition states */
 enum dim_trans { ENTER, EXIT, SIZE_DIM };
 
+/* Idle thresholds reached by user inactivity (bitmask) */
+enum idle_states { IDLE_ACTIVE = 0, IDLE_DIM = 0x01, IDLE_DPMS = 0x02 };
+
 /* Lid states */
 enum lid_states { OPEN, CLOSED, DOCKED, SIZE_LID };
 
@@ -99,6 +102,12 @@ enum mod_msg_types {
     PM_REQ,             // Publish to set a new PowerManagement inhibition state,
     SENS_UPD,           // Subscribe to receive "SensorAvail" states
     NEXT_DAYEVT_UPD,    // Subscribe to receive notifications about next day event (ie: sunrise or sunset)
+    TIMER_UPD,          // Received (no need to subscribe) by timer owner module when one of its timers expires
+    DEEP_IDLE_UPD,      // Subscribe to receive new deep-idle states (ie: nobody can see the screen)
+    SUSPEND_UPD,        // Subscribe to receive system suspend/resume notifications
+    IDLE_UPD,           // Subscribe to receive new idle states (ie: which idle thresholds were reached)
+    CAPTURE_UPD,        // Subscribe to receive capture results, once BACKLIGHT is done with a CAPTURE_REQ or a timed capture
+    SUSPEND_ACK_REQ,    // Publish to let SLEEP know a SUSPEND_UPD was handled
     MSGS_SIZE
 };
 
@@ -205,6 +214,32 @@ typedef struct {
     bool new;                   // Valued in updates. No requests available
 } sens_upd;
 
+typedef struct {
+    int id;                     // Valued in updates: id of expired timer. No requests available
+} timer_upd;
+
+typedef struct {
+    bool old;                   // Valued in updates. No requests available
+    bool new;                   // Valued in updates. No requests available
+} deep_idle_upd;
+
+typedef struct {
+    bool old;                   // Valued in updates. No requests available
+    bool new;                   // Valued in updates: true when system is going to sleep. Mandatory for acks: acknowledged value
+} suspend_upd;
+
+typedef struct {
+    int old;                    // Valued in updates: enum idle_states bitmask. No requests available
+    int new;                    // Valued in updates: enum idle_states bitmask. No requests available
+} idle_upd;
+
+typedef struct {
+    bool ok;                    // Valued in updates: whether capture succeeded. No requests available
+    double ambient_br;          // Valued in updates: captured ambient brightness. No requests available
+    double compensated_br;      // Valued in updates: ambient brightness net of screen-emitted brightness compensation. No requests available
+    double bl_pct;              // Valued in updates: backlight pct after capture. No requests available
+} captured_upd;
+
 typedef struct {
     const enum mod_msg_types type;
     union {
@@ -224,12 +259,40 @@ typedef struct {
         contrib_upd contrib;    /* CONTRIB_REQ */
         capture_upd capture;    /* CAPTURE_REQ */
         sens_upd sens;          /* SENS_UPD */
+        timer_upd timer;        /* TIMER_UPD */
+        deep_idle_upd deep_idle; /* DEEP_IDLE_UPD */
+        suspend_upd suspend;    /* SUSPEND_UPD/SUSPEND_ACK_REQ */
+        idle_upd idle;          /* IDLE_UPD */
+        captured_upd captured;  /* CAPTURE_UPD */
     };
 } message_t;
 
 /** PubSub Topics **/
 extern const char *topics[];
 
+/** Timer service **/
+
+/*
+ * Each module timeout is multiplexed on a single timerfd owned by TIMERS module.
+ * When a timer expires, a TIMER_UPD message is sent to its owner (eg: self()).
+ * timer_set() and timer_reset() share old set_timeout() and reset_timer() semantics.
+ * While in deep-idle, only essential timers can wake clight up;
+ * any other expired timer is delivered once deep-idle is left.
+ * While suspended, non-essential timers are held too, and their deadlines
+ * get postponed by the time spent sleeping on resume.
+ */
+int timer_new(const self_t *owner, const char *name, int initial_s, int initial_ns);
+void timer_set(int id, int sec, int nsec);
+void timer_reset(int id, int old_timer, int new_timer);
+void timer_pause(int id, bool pause);
+void timer_set_slack(int id, int slack_ms);
+void timer_set_essential(int id, bool essential);
+void timer_free(int id);
+
 /** Log function declaration **/
 
 void log_message(const char *filename, int lineno, const char type, const char *log_msg, ...);
+
+/** Stats function declaration **/
+
+void stats_publish(const enum mod_msg_types type);
@@ -37,6 +37,12 @@ const char *topics[] = {
     "PmInhibited",
     "PmReq",
     "SensorAvail",
-    "NextEvent"
+    "NextEvent",
+    "Timer",
+    "DeepIdle",
+    "Suspended",
+    "IdleState",
+    "Captured",
+    "ReqSuspendAck"
 };
 _Static_assert(sizeof(topics) / sizeof(*topics) == MSGS_SIZE, "Undefined topic.");
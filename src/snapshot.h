@@ -0,0 +1,102 @@
+#pragma once
+
+/*
+ * Clight state snapshot, published as a read-only shared memory file
+ * in $XDG_RUNTIME_DIR/CLIGHT_SNAPSHOT_FILE, and updated on each _UPD message.
+ * 
+ * Readers just mmap it once and get consistent snapshots through
+ * clight_snapshot_read(), without any further syscall nor waking up Clight.
+ * Writes are protected by a seqlock: seq is odd while Clight is updating the snapshot.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define CLIGHT_SNAPSHOT_MAGIC       0x434c534e      // "CLSN"
+#define CLIGHT_SNAPSHOT_VERSION     1               // bumped on any layout change
+#define CLIGHT_SNAPSHOT_FILE        "clight.snapshot"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;                   // seqlock counter
+    uint32_t alive;                 // 0 once Clight stopped updating the snapshot
+    int32_t ac_state;               // enum ac_states
+    int32_t display_state;          // enum display_states bitmask
+    int32_t idle_state;             // enum idle_states bitmask
+    int32_t lid_state;              // enum lid_states
+    int32_t day_time;               // enum day_states
+    int32_t next_event;             // enum day_events
+    int32_t in_event;
+    int32_t inhibited;
+    int32_t pm_inhibited;
+    int32_t sens_avail;
+    int32_t deep_idle;
+    int32_t suspended;
+    int32_t temp;
+    int32_t padding;
+    int64_t sunrise;
+    int64_t sunset;
+    double bl_pct;
+    double kbd_pct;
+    double ambient_br;
+    double screen_comp;
+    double lat;
+    double lon;
+} clight_snapshot_t;
+
+/*
+ * Map snapshot file read-only. Returns NULL on error, 
+ * or if snapshot layout is not the one this header was built for.
+ */
+static inline const clight_snapshot_t *clight_snapshot_open(void) {
+    char path[4096];
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if (!dir) {
+        return NULL;
+    }
+    snprintf(path, sizeof(path), "%s/%s", dir, CLIGHT_SNAPSHOT_FILE);
+    
+    const clight_snapshot_t *snap = NULL;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+        void *ptr = mmap(NULL, sizeof(clight_snapshot_t), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (ptr != MAP_FAILED) {
+            snap = (const clight_snapshot_t *)ptr;
+            if (snap->magic != CLIGHT_SNAPSHOT_MAGIC || snap->version != CLIGHT_SNAPSHOT_VERSION) {
+                munmap(ptr, sizeof(clight_snapshot_t));
+                snap = NULL;
+            }
+        }
+    }
+    return snap;
+}
+
+static inline void clight_snapshot_close(const clight_snapshot_t *snap) {
+    if (snap) {
+        munmap((void *)snap, sizeof(clight_snapshot_t));
+    }
+}
+
+/*
+ * Copy a consistent snapshot into out, retrying while Clight is writing it.
+ * Returns 0 if Clight is still running, -1 otherwise (out holds last known state).
+ */
+static inline int clight_snapshot_read(const clight_snapshot_t *snap, clight_snapshot_t *out) {
+    uint32_t seq;
+    do {
+        seq = __atomic_load_n(&snap->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        memcpy(out, snap, sizeof(clight_snapshot_t));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || __atomic_load_n(&snap->seq, __ATOMIC_RELAXED) != seq);
+    return out->alive ? 0 : -1;
+}
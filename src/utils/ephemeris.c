@@ -0,0 +1,120 @@
+#include <stdint.h>
+#include "ephemeris.h"
+#include "my_math.h"
+
+#define EPHEMERIS_MAGIC     0x434c4531          // "CLE1"; bump when table layout changes
+#define EPHEMERIS_DAYS      367                 // a whole (leap) year, plus 1 day for "tomorrow" on Dec 31st
+#define EPHEMERIS_ROUND     10                  // lat/lon are rounded to 0.1 degrees (~11km)
+
+static int load_table(void);
+static void store_table(void);
+static void build_table(const int lat, const int lng, const int year);
+static void init_cache_file(void);
+
+/*
+ * Yearly sunrise/sunset table, as stored in cache file.
+ */
+typedef struct {
+    uint32_t magic;
+    int32_t lat;                                // rounded latitude * EPHEMERIS_ROUND
+    int32_t lng;                                // rounded longitude * EPHEMERIS_ROUND
+    int32_t year;
+    int64_t events[EPHEMERIS_DAYS][SIZE_EVENTS];// -1 if no such event that day
+} ephemeris_t;
+
+static ephemeris_t table;
+static char cache_file[PATH_MAX + 1];
+
+/*
+ * Store in *tt today's (or tomorrow's) "event" time, looking it up in yearly table.
+ * Table is only rebuilt when it does not match rounded location or current year;
+ * as LOC_UPD is only published for location changes beyond LOC_DISTANCE_THRS,
+ * this means once per year or per relevant location change.
+ * Returns -2 if no event happens that day, like calculate_sunrise/sunset().
+ */
+int ephemeris_get(const float lat, const float lng, enum day_events event, bool tomorrow, time_t *tt) {
+    time_t now = time(NULL);
+    struct tm *timeinfo = localtime(&now);
+    if (!timeinfo) {
+        return -1;
+    }
+    
+    const int r_lat = lround(lat * EPHEMERIS_ROUND);
+    const int r_lng = lround(lng * EPHEMERIS_ROUND);
+    const int year = timeinfo->tm_year + 1900;
+    if (table.magic != EPHEMERIS_MAGIC || table.lat != r_lat || table.lng != r_lng || table.year != year) {
+        table.lat = r_lat;
+        table.lng = r_lng;
+        table.year = year;
+        if (load_table() != 0) {
+            build_table(r_lat, r_lng, year);
+            store_table();
+        }
+    }
+    
+    const int64_t t = table.events[timeinfo->tm_yday + tomorrow][event];
+    if (t == -1) {
+        return -2; // no sunrise/sunset today!
+    }
+    *tt = t;
+    return 0;
+}
+
+/*
+ * Compute the whole table in a single batch pass.
+ */
+static void build_table(const int lat, const int lng, const int year) {
+    time_t events[EPHEMERIS_DAYS][SIZE_EVENTS];
+    calculate_year_events((double)lat / EPHEMERIS_ROUND, (double)lng / EPHEMERIS_ROUND, year, events, EPHEMERIS_DAYS);
+    for (int i = 0; i < EPHEMERIS_DAYS; i++) {
+        for (int j = 0; j < SIZE_EVENTS; j++) {
+            table.events[i][j] = events[i][j];
+        }
+    }
+    table.magic = EPHEMERIS_MAGIC;
+    DEBUG("Computed %d sunrise/sunset table for %.1lf %.1lf.\n", year, (double)lat / EPHEMERIS_ROUND, (double)lng / EPHEMERIS_ROUND);
+}
+
+/*
+ * Load table from cache file, only if it matches requested (table.lat, table.lng, table.year) key.
+ */
+static int load_table(void) {
+    int ret = -1;
+    if (!strlen(cache_file)) {
+        init_cache_file();
+    }
+    
+    FILE *f = fopen(cache_file, "r");
+    if (f) {
+        ephemeris_t cached;
+        if (fread(&cached, sizeof(cached), 1, f) == 1 && cached.magic == EPHEMERIS_MAGIC && 
+            cached.lat == table.lat && cached.lng == table.lng && cached.year == table.year) {
+            
+            table = cached;
+            DEBUG("%d sunrise/sunset table loaded from cache file.\n", table.year);
+            ret = 0;
+        }
+        fclose(f);
+    }
+    return ret;
+}
+
+static void store_table(void) {
+    FILE *f = fopen(cache_file, "w");
+    if (f) {
+        if (fwrite(&table, sizeof(table), 1, f) != 1) {
+            WARN("Caching sunrise/sunset table failed: %s.\n", strerror(errno));
+        }
+        fclose(f);
+    } else {
+        WARN("Caching sunrise/sunset table failed: %s.\n", strerror(errno));
+    }
+}
+
+static void init_cache_file(void) {
+    if (getenv("XDG_CACHE_HOME")) {
+        snprintf(cache_file, PATH_MAX, "%s/clight_ephemeris", getenv("XDG_CACHE_HOME"));
+    } else {
+        snprintf(cache_file, PATH_MAX, "%s/.cache/clight_ephemeris", getpwuid(getuid())->pw_dir);
+    }
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "commons.h"
+
+int ephemeris_get(const float lat, const float lng, enum day_events event, bool tomorrow, time_t *tt);
@@ -1,10 +1,29 @@
 #include "idler.h"
+#include "stats.h"
 
 #define VALIDATE_CLIENT(client) do { if (!client || !strlen(client)) return -1; } while (0);
+#define LOGIND_SERVICE          "org.freedesktop.login1"
 
 static int parse_bus_reply(sd_bus_message *reply, const char *member, void *userdata);
 static int idle_get_client(char *client);
 static int idle_hook_update(char *client, sd_bus_slot **slot, sd_bus_message_handler_t handler);
+static int on_session_changed(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static void logind_refresh(char *client);
+static void logind_notify(char *client, int idle, uint64_t since);
+static uint64_t now_us(void);
+
+/*
+ * logind backend: user is idle when session IdleHint is set.
+ * As logind has no per-client timeout, clients are fired as soon as IdleHint is set,
+ * with a clightd-like Idle signal carrying an additional "t" argument:
+ * CLOCK_MONOTONIC time (us) user has been idle since.
+ */
+static sd_bus *logind_bus;
+static sd_bus_message_handler_t logind_handler;
+static bool logind_running;
+static int logind_idle;                     // last idle state notified to logind_handler
+static uint64_t logind_since;               // session IdleSinceHintMonotonic (us)
+static uint64_t logind_reset;               // CLOCK_MONOTONIC (us) of latest client start (ie: simulated activity)
 
 int idle_init(char *client, sd_bus_slot **slot, int timeout, sd_bus_message_handler_t handler) {
     int r = idle_get_client(client);
@@ -19,7 +38,7 @@ int idle_init(char *client, sd_bus_slot **slot, int timeout, sd_bus_message_hand
 
 end:
     if (r < 0) {
-        WARN("Clightd idle error.\n");
+        WARN("%s idle error.\n", conf.logind_idle ? "Logind" : "Clightd");
         *client = '\0'; // reset client making it useless
     }
     return -(r < 0);  // - 1 on error
@@ -27,7 +46,7 @@ end:
 
 static int parse_bus_reply(sd_bus_message *reply, const char *member, void *userdata) {
     int r = -EINVAL;
-    if (!strcmp(member, "GetClient")) {
+    if (!strcmp(member, "GetClient") || !strcmp(member, "GetSession")) {
         const char *cl;
         r = sd_bus_message_read(reply, "o", &cl);
         if (r >= 0 && cl) {
@@ -37,23 +56,40 @@ static int parse_bus_reply(sd_bus_message *reply, const char *member, void *user
     return r;
 }
 
+/* For logind backend, client is our session object path */
 static int idle_get_client(char *client) {
+    if (conf.logind_idle) {
+        SYSBUS_ARG_REPLY(args, parse_bus_reply, client, LOGIND_SERVICE, "/org/freedesktop/login1", "org.freedesktop.login1.Manager", "GetSession");
+        return call(&args, "s", "auto");
+    }
     SYSBUS_ARG_REPLY(args, parse_bus_reply, client, CLIGHTD_SERVICE, "/org/clightd/clightd/Idle", "org.clightd.clightd.Idle", "GetClient");
     return call(&args, NULL);
 }
 
 static int idle_hook_update(char *client, sd_bus_slot **slot, sd_bus_message_handler_t handler) {
+    if (conf.logind_idle) {
+        SYSBUS_ARG(args, LOGIND_SERVICE, client, "org.freedesktop.DBus.Properties", "PropertiesChanged");
+        int r = add_match(&args, slot, on_session_changed);
+        if (r == 0) {
+            logind_bus = sd_bus_slot_get_bus(*slot);
+            logind_handler = handler;
+        }
+        return r;
+    }
     SYSBUS_ARG(args, CLIGHTD_SERVICE, client, "org.clightd.clightd.Idle.Client", "Idle");
     return add_match(&args, slot, handler);
 }
 
 int idle_set_timeout(char *client, int timeout) {
     VALIDATE_CLIENT(client);
-    
+
     int r = 0;
     if (timeout > 0) {
-        SYSBUS_ARG(to_args, CLIGHTD_SERVICE, client, "org.clightd.clightd.Idle.Client", "Timeout");
-        r = set_property(&to_args, 'u', &timeout);
+        if (!conf.logind_idle) {
+            SYSBUS_ARG(to_args, CLIGHTD_SERVICE, client, "org.clightd.clightd.Idle.Client", "Timeout");
+            stats_count("idle:clightd_calls");
+            r = set_property(&to_args, 'u', &timeout);
+        }
         if (!state.inhibited) {
             /* Only start client if we are not inhibited */
             r += idle_client_start(client, timeout);
@@ -66,9 +102,18 @@ int idle_set_timeout(char *client, int timeout) {
 
 int idle_client_start(char *client, int timeout) {
     VALIDATE_CLIENT(client);
-    
+
     if (timeout > 0) {
+        if (conf.logind_idle) {
+            /* Like a restarted clightd client, fire again if session is still idle */
+            logind_running = true;
+            logind_idle = false;
+            logind_reset = now_us();
+            logind_refresh(client);
+            return 0;
+        }
         SYSBUS_ARG(args, CLIGHTD_SERVICE, client, "org.clightd.clightd.Idle.Client", "Start");
+        stats_count("idle:clightd_calls");
         return call(&args, NULL);
     }
     return 0;
@@ -76,21 +121,118 @@ int idle_client_start(char *client, int timeout) {
 
 int idle_client_stop(char *client) {
     VALIDATE_CLIENT(client);
-    
+
+    if (conf.logind_idle) {
+        /* Like clightd, a stopped client does not signal anything */
+        logind_running = false;
+        return 0;
+    }
     SYSBUS_ARG(args, CLIGHTD_SERVICE, client, "org.clightd.clightd.Idle.Client", "Stop");
+    stats_count("idle:clightd_calls");
     return call(&args, NULL);
 }
 
+/*
+ * Both Stop and Start are sent without waiting for a reply:
+ * clightd processes them in order.
+ */
 int idle_client_reset(char *client, int timeout) {
     return idle_client_stop(client) + idle_client_start(client, timeout);
 }
 
 int idle_client_destroy(char *client) {
     VALIDATE_CLIENT(client);
-    
+
     /* Properly stop client */
     idle_client_stop(client);
 
+    if (conf.logind_idle) {
+        logind_handler = NULL;
+        return 0;
+    }
+
     SYSBUS_ARG(args, CLIGHTD_SERVICE, "/org/clightd/clightd/Idle", "org.clightd.clightd.Idle", "DestroyClient");
     return call(&args, "o", client);
 }
+
+/*
+ * logind emits IdleHint and IdleSinceHint* together on PropertiesChanged:
+ * parse them straight from the signal, avoiding further calls.
+ */
+static int on_session_changed(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
+    int idle = -1;
+    uint64_t since = logind_since;
+
+    int r = sd_bus_message_skip(m, "s");
+    if (r >= 0) {
+        r = sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY, "{sv}");
+    }
+    while (r >= 0 && sd_bus_message_enter_container(m, SD_BUS_TYPE_DICT_ENTRY, "sv") > 0) {
+        const char *name = NULL;
+        r = sd_bus_message_read(m, "s", &name);
+        if (r >= 0) {
+            if (!strcmp(name, "IdleHint")) {
+                r = sd_bus_message_read(m, "v", "b", &idle);
+            } else if (!strcmp(name, "IdleSinceHintMonotonic")) {
+                r = sd_bus_message_read(m, "v", "t", &since);
+            } else {
+                r = sd_bus_message_skip(m, "v");
+            }
+        }
+        sd_bus_message_exit_container(m);
+    }
+
+    if (r >= 0 && idle != -1) {
+        logind_notify((char *)sd_bus_message_get_path(m), idle, since);
+    }
+    return 0;
+}
+
+/* Read current session idle state, eg: when starting */
+static void logind_refresh(char *client) {
+    int idle = false;
+    uint64_t since = 0;
+    SYSBUS_ARG(hint_args, LOGIND_SERVICE, client, "org.freedesktop.login1.Session", "IdleHint");
+    SYSBUS_ARG(since_args, LOGIND_SERVICE, client, "org.freedesktop.login1.Session", "IdleSinceHintMonotonic");
+    if (get_property(&hint_args, "b", &idle, sizeof(idle)) == 0 &&
+        (!idle || get_property(&since_args, "t", &since, sizeof(since)) == 0)) {
+
+        logind_notify(client, idle, since);
+    }
+}
+
+/*
+ * Forward logind idle state changes to client handler,
+ * as a clightd-like Idle(b) signal.
+ */
+static void logind_notify(char *client, int idle, uint64_t since) {
+    logind_since = since;
+    if (!logind_running || !logind_handler || !!idle == logind_idle) {
+        return;
+    }
+    logind_idle = !!idle;
+
+    /* Latest client start counts as user activity */
+    const uint64_t idle_since = since > logind_reset ? since : logind_reset;
+    sd_bus_message *m = NULL;
+    int r = sd_bus_message_new_signal(logind_bus, &m, client, "org.clightd.clightd.Idle.Client", "Idle");
+    if (r >= 0) {
+        r = sd_bus_message_append(m, "bt", logind_idle, idle_since);
+    }
+    if (r >= 0) {
+        /* Make message readable */
+        r = sd_bus_message_seal(m, 0, 0);
+    }
+    if (r >= 0) {
+        logind_handler(m, NULL, NULL);
+    } else {
+        WARN("Failed to forward logind idle state: %s.\n", strerror(-r));
+    }
+    sd_bus_message_unref(m);
+}
+
+static uint64_t now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
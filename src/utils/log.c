@@ -1,6 +1,7 @@
 #include <sys/file.h>
+#include <inttypes.h>
 #include <sys/stat.h>
-#include "commons.h"
+#include "stats.h"
 
 static void log_bl_conf(bl_conf_t *bl_conf);
 static void log_sens_conf(sensor_conf_t *sens_conf);
@@ -11,6 +12,9 @@ static void log_dim_conf(dimmer_conf_t *dim_conf);
 static void log_dpms_conf(dpms_conf_t *dpms_conf);
 static void log_scr_conf(screen_conf_t *screen_conf);
 static void log_inh_conf(inh_conf_t *inh_conf);
+static void log_wakeup(const char *source, uint64_t count, double rate, void *userdata);
+static void log_counter(const char *counter, uint64_t count, void *userdata);
+static void log_histogram(const char *hist, const uint64_t *buckets, uint64_t count, double sum, void *userdata);
 
 static FILE *log_file;
 
@@ -76,6 +80,7 @@ static void log_gamma_conf(gamma_conf_t *gamma_conf) {
     fprintf(log_file, "* Daily screen temp:\t\t%d\n", gamma_conf->temp[DAY]);
     fprintf(log_file, "* Nightly screen temp:\t\t%d\n", gamma_conf->temp[NIGHT]);
     fprintf(log_file, "* Long transition:\t\t%s\n", gamma_conf->long_transition ? "Enabled" : "Disabled");
+    fprintf(log_file, "* Mired threshold:\t\t%d\n", gamma_conf->mired_thres);
     fprintf(log_file, "* Ambient gamma:\t\t%s\n", gamma_conf->ambient_gamma ? "Enabled" : "Disabled");
 }
 
@@ -112,6 +117,9 @@ static void log_scr_conf(screen_conf_t *screen_conf) {
     fprintf(log_file, "* Timeouts:\t\tAC %d\tBATT %d\n", screen_conf->timeout[ON_AC], screen_conf->timeout[ON_BATTERY]);
     fprintf(log_file, "* Contrib:\t\t%.2lf\n", screen_conf->contrib);
     fprintf(log_file, "* Samples:\t\t%d\n", screen_conf->samples);
+    fprintf(log_file, "* Max backoff:\t\t%d\n", screen_conf->max_backoff);
+    fprintf(log_file, "* Decay:\t\t%d\n", screen_conf->decay);
+    fprintf(log_file, "* Sync capture:\t\t%s\n", screen_conf->sync_capture ? "Enabled" : "Disabled");
 }
 
 static void log_inh_conf(inh_conf_t *inh_conf) {
@@ -135,6 +143,10 @@ void log_conf(void) {
         
         fprintf(log_file, "\n### GENERIC ###\n");
         fprintf(log_file, "* Verbose (debug):\t\t%s\n", conf.verbose ? "Enabled" : "Disabled");
+        fprintf(log_file, "* Timer slack:\t\t%d ms\n", conf.timer_slack);
+        fprintf(log_file, "* Idle source:\t\t%s\n", conf.logind_idle ? "Logind" : "Clightd");
+        fprintf(log_file, "* Metrics:\t\t%s\n", conf.metrics ? "Enabled" : "Disabled");
+        fprintf(log_file, "* Control socket:\t\t%s\n", conf.control_socket ? "Enabled" : "Disabled");
         
         if (!conf.bl_conf.disabled) {
             log_bl_conf(&conf.bl_conf);
@@ -172,6 +184,34 @@ void log_conf(void) {
     }
 }
 
+static void log_wakeup(const char *source, uint64_t count, double rate, UNUSED void *userdata) {
+    fprintf(log_file, "* %s:\t\t%" PRIu64 " (%.2lf/h)\n", source, count, rate);
+}
+
+static void log_counter(const char *counter, uint64_t count, UNUSED void *userdata) {
+    fprintf(log_file, "* %s:\t\t%" PRIu64 "\n", counter, count);
+}
+
+static void log_histogram(const char *hist, UNUSED const uint64_t *buckets, uint64_t count, double sum, UNUSED void *userdata) {
+    fprintf(log_file, "* %s:\t\t%" PRIu64 " (avg %.3lf ms)\n", hist, count, count > 0 ? sum * 1000 / count : 0.0);
+}
+
+/* Write a summary of wakeups by source, powertop-style */
+void log_stats(void) {
+    if (log_file) {
+        const uint64_t uptime = stats_uptime();
+        fprintf(log_file, "\n### WAKEUPS ###\n");
+        fprintf(log_file, "* Uptime:\t\t%" PRIu64 "s\n", uptime);
+        fprintf(log_file, "* Window:\t\t%.0lfs\n", stats_window());
+        stats_foreach_wakeup(log_wakeup, NULL);
+        fprintf(log_file, "\n### COUNTERS ###\n");
+        stats_foreach_counter(log_counter, NULL);
+        fprintf(log_file, "\n### LATENCIES ###\n");
+        stats_foreach_histogram(log_histogram, NULL);
+        fflush(log_file);
+    }
+}
+
 void log_message(const char *filename, int lineno, const char type, const char *log_msg, ...) {
     if (type != 'D' || conf.verbose) {
         va_list file_args, args;
@@ -180,10 +220,14 @@ void log_message(const char *filename, int lineno, const char type, const char *
         va_copy(args, file_args);
         if (log_file) {
             time_t t = time(NULL);
-            struct tm *tm = localtime(&t);
-            fprintf(log_file, "(%c)[%02d:%02d:%02d]{%s:%d}\t", type, tm->tm_hour, tm->tm_min, tm->tm_sec, filename, lineno);
+            struct tm tm;
+            localtime_r(&t, &tm);
+            /* INTERFACE logs from its own thread: keep lines whole */
+            flockfile(log_file);
+            fprintf(log_file, "(%c)[%02d:%02d:%02d]{%s:%d}\t", type, tm.tm_hour, tm.tm_min, tm.tm_sec, filename, lineno);
             vfprintf(log_file, log_msg, file_args);
             fflush(log_file);
+            funlockfile(log_file);
         }
 
         /* In case of error, log to stdout too */
@@ -9,4 +9,5 @@ do { \
 
 void open_log(void);
 void log_conf(void);
+void log_stats(void);
 void close_log(void);
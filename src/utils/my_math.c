@@ -5,6 +5,8 @@
 #define ZENITH -0.83
 
 static float to_hours(const float rad);
+static int calculate_event_hour(const float lat, const float lng, const int yday, enum day_events event, double *ut);
+static int event_time(struct tm *date, const double ut, time_t *tt);
 static int calculate_sunrise_sunset(const float lat, const float lng, time_t *tt, enum day_events event, bool tomorrow);
 
 /*
@@ -81,37 +83,18 @@ static float to_hours(const float rad) {
 }
 
 /*
- * Just a small function to compute sunset/sunrise for today (or tomorrow).
+ * Compute UTC time (in hours) of "event" on yday day of the year, at given location.
+ * Returns -2 if no such event happens that day (eg: polar day/night).
  * See: http://stackoverflow.com/questions/7064531/sunrise-sunset-times-in-c
- * If conf.events[event] is set, it means "event" time is user-set.
- * So, only store in *tt its corresponding time_t values.
  */
-static int calculate_sunrise_sunset(const float lat, const float lng, time_t *tt, enum day_events event, bool tomorrow) {
-    // 1. compute the day of the year (timeinfo->tm_yday below)
-    time(tt);
-    struct tm *timeinfo = localtime(tt);
-    if (!timeinfo) {
-        return -1;
-    }
-    // if needed, set tomorrow
-    timeinfo->tm_yday += tomorrow;
-    timeinfo->tm_mday += tomorrow;
-    timeinfo->tm_sec = 0;
-
-    /* If user provided a sunrise/sunset time, use them */
-    if (strlen(conf.day_conf.day_events[event]) > 0) {
-        strptime(conf.day_conf.day_events[event], "%R", timeinfo);
-        *tt = mktime(timeinfo);
-        return 0;
-    }
-
+static int calculate_event_hour(const float lat, const float lng, const int yday, enum day_events event, double *ut) {
     // 2. convert the longitude to hour value and calculate an approximate time
     float lngHour = to_hours(lng);
     float t;
     if (event == SUNRISE) {
-        t = timeinfo->tm_yday + (6.0 - lngHour) / 24.0;
+        t = yday + (6.0 - lngHour) / 24.0;
     } else {
-        t = timeinfo->tm_yday + (18.0 - lngHour) / 24.0;
+        t = yday + (18.0 - lngHour) / 24.0;
     }
 
     // 3. calculate the Sun's mean anomaly
@@ -154,23 +137,82 @@ static int calculate_sunrise_sunset(const float lat, const float lng, time_t *tt
     float T = H + RA - (0.06571 * t) - 6.622;
 
     // 9. adjust back to UTC
-    float UT = fmod(24 + fmod(T - lngHour, 24.0), 24.0);
+    *ut = fmod(24 + fmod(T - lngHour, 24.0), 24.0);
+    return 0;
+}
 
+/*
+ * Store in *tt "date" day at UT hours.
+ */
+static int event_time(struct tm *date, const double ut, time_t *tt) {
     double hours;
-    double minutes = modf(UT, &hours) * 60;
+    double minutes = modf(ut, &hours) * 60;
 
     // set correct values
-    timeinfo->tm_hour = hours;
-    timeinfo->tm_min = minutes;
+    date->tm_hour = hours;
+    date->tm_min = minutes;
+    date->tm_sec = 0;
 
     // store in user provided ptr correct data
-    *tt = timegm(timeinfo);
+    *tt = timegm(date);
     if (*tt == (time_t) -1) {
         return -1;
     }
     return 0;
 }
 
+/*
+ * Just a small function to compute sunset/sunrise for today (or tomorrow).
+ * If conf.events[event] is set, it means "event" time is user-set.
+ * So, only store in *tt its corresponding time_t values.
+ */
+static int calculate_sunrise_sunset(const float lat, const float lng, time_t *tt, enum day_events event, bool tomorrow) {
+    // 1. compute the day of the year (timeinfo->tm_yday below)
+    time(tt);
+    struct tm *timeinfo = localtime(tt);
+    if (!timeinfo) {
+        return -1;
+    }
+    // if needed, set tomorrow
+    timeinfo->tm_yday += tomorrow;
+    timeinfo->tm_mday += tomorrow;
+    timeinfo->tm_sec = 0;
+
+    /* If user provided a sunrise/sunset time, use them */
+    if (strlen(conf.day_conf.day_events[event]) > 0) {
+        strptime(conf.day_conf.day_events[event], "%R", timeinfo);
+        *tt = mktime(timeinfo);
+        return 0;
+    }
+
+    double ut;
+    int ret = calculate_event_hour(lat, lng, timeinfo->tm_yday, event, &ut);
+    if (ret == 0) {
+        ret = event_time(timeinfo, ut, tt);
+    }
+    return ret;
+}
+
+/*
+ * Batch compute sunrise and sunset times for first num_days days of year,
+ * at given location, in a single pass.
+ * Days without sunrise/sunset get a -1 event time.
+ */
+void calculate_year_events(const float lat, const float lng, const int year, time_t (*events)[SIZE_EVENTS], const int num_days) {
+    for (int yday = 0; yday < num_days; yday++) {
+        for (int event = SUNRISE; event < SIZE_EVENTS; event++) {
+            /* timegm() normalizes out of range tm_mday */
+            struct tm date = { .tm_year = year - 1900, .tm_mday = yday + 1 };
+            double ut;
+            if (calculate_event_hour(lat, lng, yday, event, &ut) != 0 || 
+                event_time(&date, ut, &events[yday][event]) != 0) {
+                
+                events[yday][event] = -1;
+            }
+        }
+    }
+}
+
 int calculate_sunrise(const float lat, const float lng, time_t *tt, bool tomorrow) {
     return calculate_sunrise_sunset(lat, lng, tt, SUNRISE, tomorrow);
 }
@@ -179,6 +221,47 @@ int calculate_sunset(const float lat, const float lng, time_t *tt, bool tomorrow
     return calculate_sunrise_sunset(lat, lng, tt, SUNSET, tomorrow);
 }
 
+/*
+ * Compute solar elevation angle (in degrees, above horizon) at time t for given location.
+ * See: https://gml.noaa.gov/grad/solcalc/calcdetails.html
+ */
+double solar_elevation(const float lat, const float lng, const time_t t) {
+    /* Julian century since J2000.0 */
+    const double jc = ((t / 86400.0 + 2440587.5) - 2451545.0) / 36525.0;
+    
+    /* Sun geometric mean longitude and anomaly, earth orbit eccentricity */
+    const double l0 = fmod(280.46646 + jc * (36000.76983 + jc * 0.0003032), 360.0);
+    const double m = 357.52911 + jc * (35999.05029 - 0.0001537 * jc);
+    const double e = 0.016708634 - jc * (0.000042037 + 0.0000001267 * jc);
+    
+    /* Sun apparent longitude */
+    const double c = sin(degToRad(m)) * (1.914602 - jc * (0.004817 + 0.000014 * jc)) 
+                    + sin(degToRad(2 * m)) * (0.019993 - 0.000101 * jc) 
+                    + sin(degToRad(3 * m)) * 0.000289;
+    const double omega = 125.04 - 1934.136 * jc;
+    const double app_long = l0 + c - 0.00569 - 0.00478 * sin(degToRad(omega));
+    
+    /* Obliquity of ecliptic and Sun declination */
+    const double obliq = 23 + (26 + (21.448 - jc * (46.815 + jc * (0.00059 - jc * 0.001813))) / 60) / 60 
+                        + 0.00256 * cos(degToRad(omega));
+    const double decl = asin(sin(degToRad(obliq)) * sin(degToRad(app_long)));
+    
+    /* Equation of time, in minutes */
+    const double y = pow(tan(degToRad(obliq / 2)), 2);
+    const double eq_time = 4 * radToDeg(y * sin(2 * degToRad(l0)) 
+                                        - 2 * e * sin(degToRad(m)) 
+                                        + 4 * e * y * sin(degToRad(m)) * cos(2 * degToRad(l0)) 
+                                        - 0.5 * y * y * sin(4 * degToRad(l0)) 
+                                        - 1.25 * e * e * sin(2 * degToRad(m)));
+    
+    /* True solar time (minutes) and hour angle (degrees) */
+    const double tst = fmod(fmod(t, 86400) / 60.0 + eq_time + 4 * lng + 2 * 1440, 1440);
+    const double hour_angle = tst / 4 - 180;
+    
+    const double zenith = acos(sin(degToRad(lat)) * sin(decl) + cos(degToRad(lat)) * cos(decl) * cos(degToRad(hour_angle)));
+    return 90 - radToDeg(zenith);
+}
+
 /*
  * Get distance between 2 locations
  */
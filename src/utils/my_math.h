@@ -9,4 +9,6 @@ void polynomialfit(double *XPoints, double *YPoints, double *out_params, int num
 double clamp(double value, double max, double min);
 int calculate_sunrise(const float lat, const float lng, time_t *tt, bool tomorrow) ;
 int calculate_sunset(const float lat, const float lng, time_t *tt, bool tomorrow);
+void calculate_year_events(const float lat, const float lng, const int year, time_t (*events)[SIZE_EVENTS], const int num_days);
+double solar_elevation(const float lat, const float lng, const time_t t);
 double get_distance(loc_t *loc1, loc_t *loc2);
@@ -0,0 +1,203 @@
+#include <module/map.h>
+#include <pthread.h>
+#include "stats.h"
+
+typedef struct {
+    uint64_t buckets[STATS_HIST_BUCKETS];
+    uint64_t count;
+    double sum;
+} stats_hist_t;
+
+static void inc(map_t *m, const char *key);
+
+const double stats_hist_bounds[STATS_HIST_BUCKETS - 1] = STATS_HIST_BOUNDS;
+
+static map_t *wakeups;
+static map_t *counters;
+static map_t *histograms;
+static uint64_t published[MSGS_SIZE];      // published messages, by topic
+static struct timespec start_time;
+static struct timespec reset_time;         // wakeup rates are computed since last reset
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER; // INTERFACE runs on its own thread; callbacks must not call back into stats
+
+void stats_init(void) {
+    clock_gettime(CLOCK_BOOTTIME, &start_time);
+    reset_time = start_time;
+    wakeups = map_new(true, free);
+    counters = map_new(true, free);
+    histograms = map_new(true, free);
+}
+
+void stats_destroy(void) {
+    map_free(wakeups);
+    wakeups = NULL;
+    map_free(counters);
+    counters = NULL;
+    map_free(histograms);
+    histograms = NULL;
+}
+
+static void inc(map_t *m, const char *key) {
+    if (!m) {
+        return;
+    }
+    
+    pthread_mutex_lock(&mtx);
+    uint64_t *count = map_get(m, key);
+    if (!count) {
+        count = calloc(1, sizeof(uint64_t));
+        if (count && map_put(m, key, count) != MAP_OK) {
+            free(count);
+            count = NULL;
+        }
+    }
+    if (count) {
+        (*count)++;
+    }
+    pthread_mutex_unlock(&mtx);
+}
+
+/*
+ * Account a wakeup for given source,
+ * eg: a timer, a bus signal or a received unix signal.
+ */
+void stats_wakeup(const char *source) {
+    inc(wakeups, source);
+}
+
+/*
+ * Increment a generic event counter,
+ * eg: issued or skipped gamma Set calls.
+ */
+void stats_count(const char *counter) {
+    inc(counters, counter);
+}
+
+/*
+ * Observe a value (eg: a duration in seconds) in a fixed-buckets histogram,
+ * eg: captures or bus calls latency.
+ */
+void stats_observe(const char *hist, double value) {
+    if (!histograms) {
+        return;
+    }
+    
+    pthread_mutex_lock(&mtx);
+    stats_hist_t *h = map_get(histograms, hist);
+    if (!h) {
+        h = calloc(1, sizeof(stats_hist_t));
+        if (h && map_put(histograms, hist, h) != MAP_OK) {
+            free(h);
+            h = NULL;
+        }
+    }
+    if (h) {
+        int i = 0;
+        while (i < STATS_HIST_BUCKETS - 1 && value > stats_hist_bounds[i]) {
+            i++;
+        }
+        h->buckets[i]++;
+        h->count++;
+        h->sum += value;
+    }
+    pthread_mutex_unlock(&mtx);
+}
+
+/*
+ * Account a published pubsub message.
+ * Called by M_PUB() for each message: just an atomic array increment.
+ */
+void stats_publish(const enum mod_msg_types type) {
+    if (type >= 0 && type < MSGS_SIZE) {
+        __atomic_add_fetch(&published[type], 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Reset any wakeup and counter, eg: to measure a specific scenario */
+void stats_reset(void) {
+    pthread_mutex_lock(&mtx);
+    if (wakeups) {
+        map_clear(wakeups);
+    }
+    if (counters) {
+        map_clear(counters);
+    }
+    if (histograms) {
+        map_clear(histograms);
+    }
+    for (int i = 0; i < MSGS_SIZE; i++) {
+        __atomic_store_n(&published[i], 0, __ATOMIC_RELAXED);
+    }
+    clock_gettime(CLOCK_BOOTTIME, &reset_time);
+    pthread_mutex_unlock(&mtx);
+}
+
+/* Seconds elapsed since clight start, including time spent suspended */
+uint64_t stats_uptime(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    return now.tv_sec - start_time.tv_sec;
+}
+
+/* Seconds elapsed since last stats reset, ie: the window wakeup rates are measured on */
+double stats_window(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    pthread_mutex_lock(&mtx);
+    const double window = (now.tv_sec - reset_time.tv_sec) + (now.tv_nsec - reset_time.tv_nsec) / 1e9;
+    pthread_mutex_unlock(&mtx);
+    return window;
+}
+
+void stats_foreach_wakeup(stats_cb cb, void *userdata) {
+    if (!wakeups) {
+        return;
+    }
+    
+    /* Scale by the real window; just avoid dividing by (almost) nothing right after a reset */
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    pthread_mutex_lock(&mtx);
+    const double window = (now.tv_sec - reset_time.tv_sec) + (now.tv_nsec - reset_time.tv_nsec) / 1e9;
+    const double hours = (window > 1.0 ? window : 1.0) / 3600;
+    for (map_itr_t *itr = map_itr_new(wakeups); itr; itr = map_itr_next(itr)) {
+        const uint64_t *count = map_itr_get_data(itr);
+        cb(map_itr_get_key(itr), *count, *count / hours, userdata);
+    }
+    pthread_mutex_unlock(&mtx);
+}
+
+void stats_foreach_counter(stats_counter_cb cb, void *userdata) {
+    if (!counters) {
+        return;
+    }
+    
+    pthread_mutex_lock(&mtx);
+    for (map_itr_t *itr = map_itr_new(counters); itr; itr = map_itr_next(itr)) {
+        const uint64_t *count = map_itr_get_data(itr);
+        cb(map_itr_get_key(itr), *count, userdata);
+    }
+    pthread_mutex_unlock(&mtx);
+    
+    for (int i = 0; i < MSGS_SIZE; i++) {
+        const uint64_t count = __atomic_load_n(&published[i], __ATOMIC_RELAXED);
+        if (count > 0) {
+            char counter[64];
+            snprintf(counter, sizeof(counter), "pubsub:%s", topics[i]);
+            cb(counter, count, userdata);
+        }
+    }
+}
+
+void stats_foreach_histogram(stats_hist_cb cb, void *userdata) {
+    if (!histograms) {
+        return;
+    }
+    
+    pthread_mutex_lock(&mtx);
+    for (map_itr_t *itr = map_itr_new(histograms); itr; itr = map_itr_next(itr)) {
+        const stats_hist_t *h = map_itr_get_data(itr);
+        cb(map_itr_get_key(itr), h->buckets, h->count, h->sum, userdata);
+    }
+    pthread_mutex_unlock(&mtx);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "commons.h"
+
+/* Callback called for each wakeup source, with its number of wakeups and its per-hour rate */
+typedef void (*stats_cb)(const char *source, uint64_t count, double rate, void *userdata);
+/* Callback called for each counter, with its value */
+typedef void (*stats_counter_cb)(const char *counter, uint64_t count, void *userdata);
+/* Callback called for each histogram, with its per-bucket (non cumulative) counts, total count and sum of observed values */
+typedef void (*stats_hist_cb)(const char *hist, const uint64_t *buckets, uint64_t count, double sum, void *userdata);
+
+/* Histograms bucket upper bounds, in seconds; last bucket is +Inf */
+#define STATS_HIST_BOUNDS       { 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1.0, 5.0 }
+#define STATS_HIST_BUCKETS      9
+
+extern const double stats_hist_bounds[STATS_HIST_BUCKETS - 1];
+
+void stats_init(void);
+void stats_destroy(void);
+void stats_wakeup(const char *source);
+void stats_count(const char *counter);
+void stats_observe(const char *hist, double value);
+void stats_reset(void);
+uint64_t stats_uptime(void);
+double stats_window(void);
+void stats_foreach_wakeup(stats_cb cb, void *userdata);
+void stats_foreach_counter(stats_counter_cb cb, void *userdata);
+void stats_foreach_histogram(stats_hist_cb cb, void *userdata);
@@ -20,8 +20,9 @@ int start_timer(int clockid, int initial_s, int initial_ns) {
 
 /*
  * Helper to set a new trigger on timerfd in sec seconds and n nsec
+ * (or at sec seconds and nsec if TFD_TIMER_ABSTIME flag is passed)
  */
-void set_timeout(int sec, int nsec, int fd, int flag) {
+void set_timeout(time_t sec, int nsec, int fd, int flag) {
     struct itimerspec timerValue = {{0}};
 
     if (sec < 0) {
@@ -35,7 +36,7 @@ void set_timeout(int sec, int nsec, int fd, int flag) {
     }
     if (flag == 0) {
         if (sec != 0 || nsec != 0) {
-            DEBUG("Set timeout of %ds %dns on fd %d.\n", sec, nsec, fd);
+            DEBUG("Set timeout of %lds %dns on fd %d.\n", sec, nsec, fd);
         } else {
             DEBUG("Disarmed timerfd on fd %d.\n", fd);
         }
@@ -71,7 +72,14 @@ void reset_timer(int fd, int old_timer, int new_timer) {
     }
 }
 
-void read_timer(int fd) {
+/*
+ * Returns -1 if timer has been cancelled,
+ * ie: TFD_TIMER_CANCEL_ON_SET was set and realtime clock jumped.
+ */
+int read_timer(int fd) {
     uint64_t t;
-    read(fd, &t, sizeof(uint64_t));
+    if (read(fd, &t, sizeof(uint64_t)) == -1 && errno == ECANCELED) {
+        return -1;
+    }
+    return 0;
 }